@@ -83,7 +83,7 @@ error_init(const char *argv0, int facility) {
 **************************************************************************************************/
 static void
 __error_out(int priority, const char *out, char **err_last) {
-  static int  repeat = 0;
+  static THREADLOCAL int  repeat = 0;
 
   if (err_last) {
     /* Don't output the same error message again and again */
@@ -117,7 +117,7 @@ _error_out(
 	const char *msg 
 ) {
   /* The last error message output, so we don't repeat ourselves */
-  static char *err_last = NULL;
+  static THREADLOCAL char *err_last = NULL;
   char *out = NULL;
 
   /* Construct 'out' - the output */
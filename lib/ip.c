@@ -49,7 +49,7 @@ _sockclose(int fd, const char *file, int line) {
 **************************************************************************************************/
 const char *
 ipaddr(int family, void *addr) {
-  static char *addrbuf = NULL;
+  static THREADLOCAL char *addrbuf = NULL;
   int addrbufsize = INET_ADDRSTRLEN;
 #if HAVE_IPV6
   addrbufsize = MAX(addrbufsize, INET6_ADDRSTRLEN);
@@ -14,8 +14,182 @@
 /* To include macros and support definitions */
 #include "mydnsutil.h"
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SCHED_H
+#include <sched.h>
+#endif
+
 #define DEBUG_MEMMAN 1
 
+#if SHARED_MEMORY
+/*
+ * The shared arena is a header followed by blocks carved off the top of the mapping.
+ * Blocks come in power-of-two size classes, a freed block goes on the free list of its class
+ * and is only ever reused for that class.  Nothing is split or merged so every operation is
+ * constant time under the one arena lock.
+ */
+#define SHARED_MINSHIFT		5			/* Smallest block is 32 octets */
+#define SHARED_CLASSES		22			/* Largest block is 64 MB */
+#define SHARED_MAGIC		0x53484d42		/* "SHMB" */
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS		MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE		0
+#endif
+
+typedef union _shared_block {
+  struct {
+    uint32_t			sclass;			/* Size class of the block */
+    uint32_t			magic;
+    union _shared_block		*next;			/* Next free block of the class */
+  } b;
+  double			align[2];		/* Keep the payload aligned */
+} SHARED_BLOCK;
+
+typedef struct _shared_arena {
+  mydns_lock_t			lock;
+  size_t			size;			/* Size of the mapping */
+  size_t			top;			/* Offset of the first unused octet */
+  size_t			used;			/* Octets in blocks handed out */
+  SHARED_BLOCK			*free[SHARED_CLASSES];
+} SHARED_ARENA;
+
+static SHARED_ARENA		*shared_arena = NULL;
+static char			*shared_end = NULL;
+#endif
+
+void
+mydns_lock(mydns_lock_t *lock) {
+#if SHARED_MEMORY
+  register int spins = 0;
+
+  while (!mydns_trylock(lock)) {
+    /* Spin on a plain read, give up the CPU if the holder is taking a while */
+    while (*lock) {
+      if (++spins >= 1024) {
+	spins = 0;
+#if HAVE_SCHED_H
+	sched_yield();
+#endif
+      }
+    }
+  }
+#endif
+}
+
+/* Create the shared arena - returns 0 on success, -1 if shared memory is not available */
+int
+mydns_shared_init(size_t size) {
+#if SHARED_MEMORY
+  void *map = NULL;
+
+  if (shared_arena) return (0);
+
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map == MAP_FAILED) return (-1);
+
+  shared_arena = (SHARED_ARENA *)map;
+  shared_arena->size = size;
+  shared_arena->top = (sizeof(SHARED_ARENA) + sizeof(SHARED_BLOCK) - 1) & ~(sizeof(SHARED_BLOCK) - 1);
+  shared_end = (char *)map + size;
+  return (0);
+#else
+  return (-1);
+#endif
+}
+
+/* Is the object inside the shared arena? */
+int
+mydns_shared_owns(const void *object) {
+#if SHARED_MEMORY
+  return (shared_arena && (char *)object > (char *)shared_arena && (char *)object < shared_end);
+#else
+  return (0);
+#endif
+}
+
+/* Allocate zeroed memory from the shared arena - returns NULL if the arena is full */
+void *
+mydns_shared_alloc(size_t size) {
+#if SHARED_MEMORY
+  SHARED_BLOCK	*block = NULL;
+  size_t	blocksize = 0;
+  int		sclass = 0;
+
+  if (!shared_arena) return (NULL);
+
+  for (sclass = 0; sclass < SHARED_CLASSES; sclass++)
+    if (((size_t)1 << (sclass + SHARED_MINSHIFT)) >= size + sizeof(SHARED_BLOCK)) break;
+  if (sclass == SHARED_CLASSES) return (NULL);
+  blocksize = (size_t)1 << (sclass + SHARED_MINSHIFT);
+
+  mydns_lock(&shared_arena->lock);
+  if ((block = shared_arena->free[sclass])) {
+    shared_arena->free[sclass] = block->b.next;
+  } else if (shared_arena->top + blocksize <= shared_arena->size) {
+    block = (SHARED_BLOCK *)((char *)shared_arena + shared_arena->top);
+    shared_arena->top += blocksize;
+  }
+  if (block) shared_arena->used += blocksize;
+  mydns_unlock(&shared_arena->lock);
+
+  if (!block) return (NULL);
+
+  block->b.sclass = sclass;
+  block->b.magic = SHARED_MAGIC;
+  block->b.next = NULL;
+  memset(block + 1, 0, blocksize - sizeof(SHARED_BLOCK));
+  return ((void *)(block + 1));
+#else
+  return (NULL);
+#endif
+}
+
+/* Return memory to the shared arena */
+void
+mydns_shared_free(void *object) {
+#if SHARED_MEMORY
+  SHARED_BLOCK	*block = NULL;
+
+  if (!object) return;
+
+  block = (SHARED_BLOCK *)object - 1;
+  if (block->b.magic != SHARED_MAGIC)
+    Errx("%p: %s", object, "not a shared memory block");
+  block->b.magic = 0;
+
+  mydns_lock(&shared_arena->lock);
+  block->b.next = shared_arena->free[block->b.sclass];
+  shared_arena->free[block->b.sclass] = block;
+  shared_arena->used -= (size_t)1 << (block->b.sclass + SHARED_MINSHIFT);
+  mydns_unlock(&shared_arena->lock);
+#endif
+}
+
+/* Octets of the shared arena in use */
+size_t
+mydns_shared_used(void) {
+#if SHARED_MEMORY
+  return (shared_arena ? shared_arena->used : 0);
+#else
+  return (0);
+#endif
+}
+
+#if SHARED_MEMORY
+/* Usable size of a shared block */
+static size_t
+__mydns_shared_size(void *object) {
+  SHARED_BLOCK *block = (SHARED_BLOCK *)object - 1;
+
+  return (((size_t)1 << (block->b.sclass + SHARED_MINSHIFT)) - sizeof(SHARED_BLOCK));
+}
+#endif
+
 static const char *
 __mydns_arenaname(arena_t arena) {
   if (arena == ARENA_GLOBAL) { return "global"; }
@@ -51,12 +225,22 @@ _mydns_vasprintf(char **strp, const char *fmt, va_list ap) {
 char *
 _mydns_strdup(const char *s, arena_t arena, const char *file, int line) {
   char *news = NULL;
+  int slen = 0;
+
+#if SHARED_MEMORY
+  if (arena >= ARENA_SHARED0 && shared_arena) {
+    slen = strlen(s);
+    news = _mydns_allocate(slen+1, 1, arena, "##char []##", file, line);
+    memcpy(news, s, slen);
+    return (news);
+  }
+#endif
 
 #if HAVE_STRDUP
   news = strdup(s);
   if (!news) Out_Of_Memory();
 #else
-  int slen = strlen(s);
+  slen = strlen(s);
   news = _mydns_allocate(slen+1, 1, arena, "##char []##", file, line);
   if (!news) Out_Of_Memory();
   strncpy(news, s, slen);
@@ -87,7 +271,13 @@ void *
 _mydns_allocate(size_t size, size_t count, arena_t arena, const char *type, const char *file, int line) {
 
   void *newobject = NULL;
-  /* We currently ignore arena which is there to allow shared memory or local allocation */
+
+#if SHARED_MEMORY
+  if (arena >= ARENA_SHARED0 && shared_arena) {
+    if (!(newobject = mydns_shared_alloc(count * size))) Out_Of_Memory();
+    return (newobject);
+  }
+#endif
 
   newobject = calloc(count, size);
 
@@ -100,7 +290,17 @@ void *
 _mydns_reallocate(void *oldobject, size_t size, size_t count, arena_t arena, const char *type, const char *file, int line) {
   void *newobject = NULL;
 
-  /* We currently ignore arena which is there to allow shared memory or local allocation */
+#if SHARED_MEMORY
+  if (mydns_shared_owns(oldobject) || (!oldobject && arena >= ARENA_SHARED0 && shared_arena)) {
+    if (!(newobject = mydns_shared_alloc(count * size))) Out_Of_Memory();
+    if (oldobject) {
+      size_t oldsize = __mydns_shared_size(oldobject);
+      memcpy(newobject, oldobject, (oldsize < count * size) ? oldsize : count * size);
+      mydns_shared_free(oldobject);
+    }
+    return (newobject);
+  }
+#endif
 
   newobject = realloc(oldobject, count * size);
 
@@ -112,7 +312,11 @@ _mydns_reallocate(void *oldobject, size_t size, size_t count, arena_t arena, con
 void
 _mydns_release(void *object, size_t count, arena_t arena, const char *file, int line) {
 
-  /* We currently ignore arena which is there to allow shared memory or local allocation */
+  /* Shared objects are recognised by address, whatever arena the caller names */
+  if (mydns_shared_owns(object)) {
+    mydns_shared_free(object);
+    return;
+  }
 
   if (object) free(object); /* Use the system free directly - do not rely on the if NULL behaviour */
 
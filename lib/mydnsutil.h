@@ -38,6 +38,7 @@
 #endif
 
 #include <stdio.h>
+#include <stddef.h>
 #include <sys/types.h>
 
 #ifdef HAVE_LIMITS_H
@@ -490,6 +491,51 @@ extern void	_mydns_release(void *, size_t, arena_t, const char *, int);
 #define RELEASE(OBJECT)	\
   RELEASE_GLOBAL(OBJECT)
 
+/*
+**  Shared memory arena (memoryman.c)
+**  A single anonymous shared mapping created before the servers are forked, so it sits at the
+**  same address in every process and plain pointers can be stored inside it.  Once it exists
+**  the ARENA_SHARED allocations come from it, otherwise they fall back to the heap.
+*/
+#if HAVE_MMAP && HAVE_SYS_MMAN_H && HAVE_SYNC_BUILTINS
+#	define SHARED_MEMORY 1
+#endif
+
+typedef volatile int	mydns_lock_t;			/* Spin lock usable in shared memory */
+
+#if SHARED_MEMORY
+#	define mydns_trylock(L)	(!__sync_lock_test_and_set((L), 1))
+#	define mydns_unlock(L)		__sync_lock_release((L))
+#	define mydns_atomic_inc(V)	__sync_fetch_and_add(&(V), 1)
+#	define mydns_atomic_add(V, N)	__sync_fetch_and_add(&(V), (N))
+#else
+#	define mydns_trylock(L)	1
+#	define mydns_unlock(L)
+#	define mydns_atomic_inc(V)	((V)++)
+#	define mydns_atomic_add(V, N)	((V) += (N))
+#endif
+
+extern void	mydns_lock(mydns_lock_t *);
+extern int	mydns_shared_init(size_t);
+extern int	mydns_shared_owns(const void *);
+extern void *	mydns_shared_alloc(size_t);
+extern void	mydns_shared_free(void *);
+extern size_t	mydns_shared_used(void);
+
+/*
+**  Threaded servers (main.c)
+**  With `threads' the servers run as threads of one process.  State that belongs to one
+**  server's event loop is declared THREADLOCAL so each thread has its own copy; the caches
+**  live in the shared arena and are locked as they are between processes.
+*/
+#if HAVE_PTHREAD_H && HAVE_PTHREAD_CREATE && HAVE_THREAD_LOCAL && SHARED_MEMORY
+#	define USE_THREADS 1
+#	include <pthread.h>
+#	define THREADLOCAL	__thread
+#else
+#	define THREADLOCAL
+#endif
+
 /* Convert str to unsigned int */
 #define atou(s) (uint32_t)strtoul(s, (char **)NULL, 10)
 
@@ -115,7 +115,7 @@ strtolower(char *str) {
 char *
 strsecs(time_t seconds) {
   int weeks, days, hours, minutes;
-  static char *str = NULL;
+  static THREADLOCAL char *str = NULL;
   char *weekstr = NULL, *daystr = NULL, *hourstr = NULL, *minutestr = NULL, *secondstr = NULL;
 
   weeks = seconds / 604800; seconds -= (weeks * 604800);
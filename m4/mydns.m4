@@ -240,6 +240,39 @@ AC_DEFUN([AC_CHECK_SOCKADDR_SA_LEN],
 )
 
 
+##
+## Check for the __sync atomic builtins (used for locks in shared memory)
+##
+AC_DEFUN([AC_CHECK_SYNC_BUILTINS],
+	[
+		AC_MSG_CHECKING([for __sync atomic builtins])
+		AC_TRY_LINK([],
+			[int v = 0; __sync_lock_test_and_set(&v, 1); __sync_fetch_and_add(&v, 1); __sync_lock_release(&v);],
+				[ AC_DEFINE([HAVE_SYNC_BUILTINS], 1, [Does the compiler have the __sync atomic builtins?])
+				  AC_MSG_RESULT([yes]) ],
+				AC_MSG_RESULT([no]))
+	]
+)
+
+
+##
+## Check for POSIX threads and thread-local storage (used for the threaded server mode)
+##
+AC_DEFUN([AC_CHECK_THREADS],
+	[
+		AC_CHECK_HEADERS([pthread.h])
+		AC_CHECK_LIB(pthread, pthread_create)
+		AC_CHECK_FUNCS([pthread_create pthread_sigmask])
+		AC_MSG_CHECKING([for thread-local storage])
+		AC_TRY_COMPILE([],
+			[static __thread int v = 0; v++;],
+				[ AC_DEFINE([HAVE_THREAD_LOCAL], 1, [Does the compiler support __thread variables?])
+				  AC_MSG_RESULT([yes]) ],
+				AC_MSG_RESULT([no]))
+	]
+)
+
+
 ##
 ##  Compile for profiling?
 ##
@@ -72,6 +72,7 @@ int		debug_data = 0;
 int		debug_db = 0;
 int		debug_encode = 0;
 int		debug_error = 0;
+int		debug_event = 0;
 int		debug_ixfr = 0;
 int		debug_ixfr_sql = 0;
 int		debug_lib_rr = 0;
@@ -91,6 +92,7 @@ int		debug_sql = 0;
 int		debug_sql_queries = 0;
 int		debug_status = 0;
 int		debug_task = 0;
+int		debug_timer = 0;
 int		debug_tcp = 0;
 int		debug_udp = 0;
 int		debug_update = 0;
@@ -138,12 +140,21 @@ static CONF defConfig[] = {
   {	"reply-cache-size",	V_("1024"),				N_("Maximum number of elements stored in the reply cache"),			NULL,		0,		NULL	},
   {	"reply-cache-expire",	V_("30"),				N_("Number of seconds after which cached replies expire"),			NULL,		0,		NULL	},
 
+  {	"shared-cache",		V_("yes"),				N_("Share the caches between server processes"),				NULL,		0,		NULL	},
+  {	"shared-memory",	V_("64"),				N_("Megabytes of memory set aside for the shared caches"),			NULL,		0,		NULL	},
+  {	"cache-hash",		V_("auto"),				N_("Hash used to index the caches one of: auto, wyhash, crc32c, fnv"),		NULL,		0,		NULL	},
+
   {	"-",			NULL,					N_("ESOTERICA"),								NULL,		0,		NULL	},
   {	"log",			V_("LOG_DAEMON"),			N_("Facility to use for program output (LOG_*/stdout/stderr)"),			NULL,		0,		NULL	},
   {	"pidfile",		V_("/var/run/"PACKAGE_NAME".pid"),	N_("Path to PID file"),								NULL,		0,		NULL	},
   {	"timeout",		V_("120"),				N_("Number of seconds after which queries time out"),				NULL,		0,		NULL	},
   {	"multicpu",		V_("-1"),				N_("Number of CPUs installed on your system - (deprecated)"),			NULL,		0,		NULL	},
   {	"servers",		V_("1"),				N_("Number of servers to run"),							NULL,		0,		NULL	},
+  {	"threads",		V_("0"),				N_("Number of server threads to run in one process instead of servers"),	NULL,		0,		NULL	},
+  {	"event-backend",	V_("auto"),				N_("IO event backend one of: auto, epoll, io_uring, kqueue, poll"),	NULL,		0,		NULL	},
+  {	"reuseport",		V_("no"),				N_("Give each server its own SO_REUSEPORT listening sockets?"),			NULL,		0,		NULL	},
+  {	"reuseport-cpu",	V_("no"),				N_("Pin servers to CPUs and steer packets to the server on the receiving CPU?"),	NULL,		0,		NULL	},
+  {	"udp-batch",		V_("32"),				N_("Number of UDP datagrams read or written per system call"),			NULL,		0,		NULL	},
   {	"recursive",		V_(""),					N_("Location of recursive resolver"),						NULL,		0,		NULL	},
   {	"recursive-timeout",	V_("1"),				N_("Number of seconds before first retry"),					NULL,		0,		NULL	},
   {	"recursive-retries",	V_("5"),				N_("Number of retries before abandoning recursion"),				NULL,		0,		NULL	},
@@ -191,6 +202,7 @@ static CONF defConfig[] = {
   {	"debug-db",		V_("0"),				N_("Enable DB code debugging"),							NULL,		0,		NULL	},
   {	"debug-encode",		V_("0"),				N_("Enable ENCODE code debugging"),						NULL,		0,		NULL	},
   {	"debug-error",		V_("0"),				N_("Enable ERROR code debugging"),						NULL,		0,		NULL	},
+  {	"debug-event",		V_("0"),				N_("Enable EVENT code debugging"),						NULL,		0,		NULL	},
   {	"debug-ixfr",		V_("0"),				N_("Enable IXFR code debugging"),						NULL,		0,		NULL	},
   {	"debug-ixfr-sql",	V_("0"),				N_("Enable IXFR SQL code debugging"),						NULL,		0,		NULL	},
   {	"debug-lib-rr",		V_("0"),				N_("Enable LIB/RR code debugging"),						NULL,		0,		NULL	},
@@ -210,6 +222,7 @@ static CONF defConfig[] = {
   {	"debug-sql-sueries",	V_("0"),				N_("Enable SQL QUERIES code debugging"),					NULL,		0,		NULL	},
   {	"debug-status",		V_("0"),				N_("Enable STATUS code debugging"),						NULL,		0,		NULL	},
   {	"debug-task",		V_("0"),				N_("Enable TASK code debugging"),						NULL,		0,		NULL	},
+  {	"debug-timer",		V_("0"),				N_("Enable TIMER code debugging"),						NULL,		0,		NULL	},
   {	"debug-tcp",		V_("0"),				N_("Enable TCP code debugging"),						NULL,		0,		NULL	},
   {	"debug-udp",		V_("0"),				N_("Enable UDP code debugging"),						NULL,		0,		NULL	},
   {	"debug-update",		V_("0"),				N_("Enable UPDATE code debugging"),						NULL,		0,		NULL	},
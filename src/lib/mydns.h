@@ -82,6 +82,7 @@ extern int		debug_data;
 extern int		debug_db;
 extern int		debug_encode;
 extern int		debug_error;
+extern int		debug_event;
 extern int		debug_ixfr;
 extern int		debug_ixfr_sql;
 extern int		debug_lib_rr;
@@ -101,6 +102,7 @@ extern int		debug_sql;
 extern int		debug_sql_queries;
 extern int		debug_status;
 extern int		debug_task;
+extern int		debug_timer;
 extern int		debug_tcp;
 extern int		debug_udp;
 extern int		debug_update;
@@ -593,6 +595,7 @@ extern int		mydns_rr_count_inactive_filtered(SQL *, uint32_t, dns_qtype_t, const
 extern int		mydns_rr_count_deleted_filtered(SQL *, uint32_t, dns_qtype_t, const char *, const char *, const char *);
 extern MYDNS_RR		*mydns_rr_dup(MYDNS_RR *, int);
 extern size_t		mydns_rr_size(MYDNS_RR *);
+extern MYDNS_RR		*mydns_rr_pack(MYDNS_RR *, void *);
 
 /* soa.c */
 extern long		mydns_soa_count(SQL *);
@@ -603,12 +606,13 @@ extern int		mydns_soa_load(SQL *, MYDNS_SOA **, const char *);
 extern int		mydns_soa_make(SQL *, MYDNS_SOA **, unsigned char *, unsigned char *);
 extern MYDNS_SOA	*mydns_soa_dup(MYDNS_SOA *, int);
 extern size_t		mydns_soa_size(MYDNS_SOA *);
+extern MYDNS_SOA	*mydns_soa_pack(MYDNS_SOA *, void *);
 extern void		_mydns_soa_free(MYDNS_SOA *);
 #define			mydns_soa_free(p)	if ((p)) _mydns_soa_free((p)), (p) = NULL
 
 
 /* sql.c */
-extern SQL		*sql;
+extern THREADLOCAL SQL *sql;
 extern void		sql_open(const char *user, const char *password, const char *host, const char *database);
 extern void		sql_reopen(void);
 extern void		_sql_close(SQL *);
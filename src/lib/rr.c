@@ -709,6 +709,66 @@ mydns_rr_dup(MYDNS_RR *start, int recurse) {
 /*--- mydns_rr_dup() ----------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	MYDNS_RR_PACK
+	Copy an RRset into the single block at `dest', which must hold mydns_rr_size() octets.
+	The records come first and their strings after them, so the copy is released with one
+	free and never with mydns_rr_free().  The stamp is not copied.
+	Returns the first record of the copy.
+**************************************************************************************************/
+static char *
+mydns_rr_pack_string(char **strings, const char *s, size_t len) {
+  char *rv = *strings;
+
+  memcpy(rv, s, len);
+  rv[len] = '\0';
+  *strings += len + 1;
+  return (rv);
+}
+
+MYDNS_RR *
+mydns_rr_pack(MYDNS_RR *start, void *dest) {
+  register MYDNS_RR *first = (MYDNS_RR *)dest, *rr, *s;
+  char *strings = NULL;
+  int count = 0;
+
+  for (s = start; s; s = s->next)
+    count++;
+  strings = (char *)(first + count);
+
+  for (s = start, rr = first; s; s = s->next, rr++) {
+    memcpy(rr, s, sizeof(MYDNS_RR));
+    rr->next = s->next ? rr + 1 : NULL;
+    rr->stamp = NULL;
+
+    __MYDNS_RR_NAME(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_NAME(s), strlen(__MYDNS_RR_NAME(s)));
+    __MYDNS_RR_DATA_VALUE(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_DATA_VALUE(s),
+						       __MYDNS_RR_DATA_LENGTH(s));
+
+    switch (rr->type) {
+    case DNS_QTYPE_RP:
+      __MYDNS_RR_RP_TXT(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_RP_TXT(s),
+						     strlen(__MYDNS_RR_RP_TXT(s)));
+      break;
+
+    case DNS_QTYPE_NAPTR:
+      __MYDNS_RR_NAPTR_SERVICE(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_NAPTR_SERVICE(s),
+							    strlen(__MYDNS_RR_NAPTR_SERVICE(s)));
+      __MYDNS_RR_NAPTR_REGEX(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_NAPTR_REGEX(s),
+							  strlen(__MYDNS_RR_NAPTR_REGEX(s)));
+      __MYDNS_RR_NAPTR_REPLACEMENT(rr) = mydns_rr_pack_string(&strings, __MYDNS_RR_NAPTR_REPLACEMENT(s),
+								strlen(__MYDNS_RR_NAPTR_REPLACEMENT(s)));
+      break;
+
+    default:
+      break;
+    }
+  }
+  return (start ? first : NULL);
+}
+/*--- mydns_rr_pack() ---------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	MYDNS_RR_SIZE
 **************************************************************************************************/
@@ -219,6 +219,24 @@ mydns_soa_dup(MYDNS_SOA *start, int recurse) {
 /*--- mydns_soa_dup() ---------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	MYDNS_SOA_PACK
+	Copy a list of SOA records into the single block at `dest', which must hold
+	mydns_soa_size() octets.  Returns the first record of the copy.
+**************************************************************************************************/
+MYDNS_SOA *
+mydns_soa_pack(MYDNS_SOA *start, void *dest) {
+  register MYDNS_SOA *soa = (MYDNS_SOA *)dest, *s;
+
+  for (s = start; s; s = s->next, soa++) {
+    memcpy(soa, s, sizeof(MYDNS_SOA));
+    soa->next = s->next ? soa + 1 : NULL;
+  }
+  return (start ? (MYDNS_SOA *)dest : NULL);
+}
+/*--- mydns_soa_pack() --------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	MYDNS_SOA_SIZE
 **************************************************************************************************/
@@ -20,7 +20,7 @@
 
 #include "mydns.h"
 
-SQL *sql;						/* Global SQL connection information */
+THREADLOCAL SQL *sql;					/* SQL connection of this server (thread) */
 
 /* Saved connection information for reconnecting */
 static char *_sql_user = NULL;
@@ -114,14 +114,16 @@ sql_reopen(void) {
   SQL *new_sql = NULL;
   char *portp = NULL;
   unsigned int port = 0;
+  char *host = NULL;
 
-  if (_sql_host && (portp = strchr(_sql_host, ':'))) {
+  /* Work on a copy of the host, server threads may be reconnecting at the same time */
+  if (_sql_host && (host = STRDUP(_sql_host)) && (portp = strchr(host, ':'))) {
     port = atoi(portp + 1);
     *portp = '\0';
   }
 
 #if USE_PGSQL
-  new_sql = PQsetdbLogin(_sql_host, portp, NULL, NULL, _sql_database, _sql_user, _sql_password);
+  new_sql = PQsetdbLogin(host, portp, NULL, NULL, _sql_database, _sql_user, _sql_password);
   if (PQstatus(new_sql) == CONNECTION_BAD) {
     if (new_sql)
       PQfinish(new_sql);
@@ -130,14 +132,19 @@ sql_reopen(void) {
     if (PQstatus(new_sql) == CONNECTION_BAD) {
       if (new_sql)
 	PQfinish(new_sql);
+      RELEASE(host);
       return;
     }
   }
 #else
-  if (!mysql_ping(sql)) return;
+  if (!mysql_ping(sql)) {
+    RELEASE(host);
+    return;
+  }
   new_sql = ALLOCATE(sizeof(*new_sql), MYSQL);
   if (!mysql_init(new_sql)) {
     RELEASE(new_sql);
+    RELEASE(host);
     return;
   }
 #if MYSQL_VERSION_ID > 32349
@@ -146,8 +153,9 @@ sql_reopen(void) {
 #if MYSQL_VERSION_ID > 50012
   mysql_options(new_sql, MYSQL_OPT_RECONNECT, "1");
 #endif
-  if (!(mysql_real_connect(new_sql, _sql_host, _sql_user, _sql_password, _sql_database, port, NULL, 0))) {
+  if (!(mysql_real_connect(new_sql, host, _sql_user, _sql_password, _sql_database, port, NULL, 0))) {
     mysql_close(new_sql);
+    RELEASE(host);
     return;
   }
 #endif
@@ -155,8 +163,7 @@ sql_reopen(void) {
   sql_close(sql);
   sql = new_sql;
 
-  if (portp)
-    *portp = ':';
+  RELEASE(host);
 }
 /*--- sql_reopen() ------------------------------------------------------------------------------*/
 
@@ -27,7 +27,7 @@
 **************************************************************************************************/
 const char *
 mydns_class_str(dns_class_t c) {
-  static char *buf = NULL;
+  static THREADLOCAL char *buf = NULL;
 
   switch (c) {
   case DNS_CLASS_UNKNOWN:	return ("UNKNOWN");
@@ -51,7 +51,7 @@ mydns_class_str(dns_class_t c) {
 **************************************************************************************************/
 const char *
 mydns_qtype_str(dns_qtype_t qtype) {
-  static char *buf = NULL;
+  static THREADLOCAL char *buf = NULL;
 
   switch (qtype) {
   case DNS_QTYPE_UNKNOWN:	return ("UNKNOWN");
@@ -148,7 +148,7 @@ mydns_qtype_str(dns_qtype_t qtype) {
 **************************************************************************************************/
 const char *
 mydns_opcode_str(dns_opcode_t opcode) {
-  static char *buf = NULL;
+  static THREADLOCAL char *buf = NULL;
 
   switch (opcode) {
   case DNS_OPCODE_UNKNOWN:	return ("UNKNOWN");
@@ -175,7 +175,7 @@ mydns_opcode_str(dns_opcode_t opcode) {
 **************************************************************************************************/
 const char *
 mydns_rcode_str(dns_rcode_t rcode) {
-  static char *buf = NULL;
+  static THREADLOCAL char *buf = NULL;
 
   switch (rcode) {
   case DNS_RCODE_UNKNOWN:	return ("UNKNOWN");
@@ -137,10 +137,6 @@ find_alias(TASK *t, char *fqdn) {
 		       xsoa->origin, zsoa->origin);
 #endif
 		if (xrr) {
-		  mydns_rr_free(xrr);
-		  if (zsoa != soa) {
-		    mydns_soa_free(zsoa);
-		  }
 		  zsoa = xsoa;
 		} else {
 		  goto NOWILDCARDMATCH;
@@ -195,10 +191,13 @@ alias_recurse(TASK *t, datasection_t section, char *fqdn, MYDNS_SOA *soa, char *
       if (rr->alias == 0) {
 	/*
 	** Override the id and name, because rrlist_add() checks for
-	** duplicates and we might have several records aliased to one
+	** duplicates and we might have several records aliased to one.
+	** `rr' may be shared with the zone cache, so change a copy.
 	*/
+	rr = mydns_rr_dup(rr, 0);
 	rr->id = alias->id;
-	strcpy(MYDNS_RR_NAME(rr), MYDNS_RR_NAME(alias));
+	RELEASE(rr->_name);
+	rr->_name = STRDUP(MYDNS_RR_NAME(alias));
 	rrlist_add(t, section, DNS_RRTYPE_RR, (void *)rr, fqdn);
 	t->sort_level++;
 	mydns_rr_free(rr);
@@ -218,7 +217,6 @@ alias_recurse(TASK *t, datasection_t section, char *fqdn, MYDNS_SOA *soa, char *
 	if (aliases[n] == rr->id) {
 	  /* ALIAS loop: We aren't going to find an A record, so we're done. */
 	  Verbose(_("%s: %s: %s (depth %d)"), desctask(t), _("ALIAS loop detected"), fqdn, depth);
-	  mydns_rr_free(rr);
 	  RELEASE(name);
 	  return (0);
 	}
@@ -226,7 +224,6 @@ alias_recurse(TASK *t, datasection_t section, char *fqdn, MYDNS_SOA *soa, char *
 
       /* Continue search with new alias. */
       strncpy(name, (char*)MYDNS_RR_DATA_VALUE(rr), sizeof(name)-1);
-      mydns_rr_free(rr);
     } else {
       Verbose("%s: %s: %s -> %s", desctask(t), _("ALIAS chain is broken"), fqdn, name);
       RELEASE(name);
@@ -410,7 +410,8 @@ axfr_fork(TASK *t) {
     DebugX("axfr", 1,_("%s: axfr_fork child has told parent I am running"), desctask(t));
 #endif
 
-    /* Clean up parents resources */
+    /* Clean up parents resources - the event set is shared with the parent so just drop it */
+    event_reset();
     free_other_tasks(t, 1);
 
 #if DEBUG_ENABLED && DEBUG_AXFR
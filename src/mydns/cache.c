@@ -37,22 +37,49 @@ CACHE *NegativeCache = NULL;						/* Negative zone cache */
 extern char	*dn_default_ns;						/* Default NS for directNIC */
 #endif
 
-
-#if (HASH_TYPE == ORIGINAL_HASH) || (HASH_TYPE == ADDITIVE_HASH)
-/**************************************************************************************************
-	ISPRIME
-	Returns 1 if `number' is a prime number, 0 if not.
-**************************************************************************************************/
-static int
-isprime(unsigned int number) {
-  register unsigned int divn = 3;
-
-  while (divn * divn < number && number % divn != 0)
-    divn += 2;
-  return (number % divn != 0);
-}
-/*--- isprime() ---------------------------------------------------------------------------------*/
-#endif
+/*
+ * Cache tables.
+ *
+ * Each cache is a table of slots indexed by a seeded hash of the name, with open addressing
+ * (linear probing) so a lookup reads consecutive slots and compares the hash kept in the slot
+ * before looking at a node at all.  Nodes are removed by moving the nodes after them back,
+ * so there are never deleted markers in the table.  The table is split into shards, each a
+ * power of two slots, picked by the top bits of the hash; a private cache has one shard.
+ *
+ * Shared caches.
+ *
+ * When there is more than one server the caches, their nodes and the cached data are all
+ * allocated in the shared memory arena before the servers are forked, so every server reads
+ * and fills the same cache.  Each shard has its own lock which is held while its slots and
+ * the nodes in them are looked at or changed; the cache lock guards the MRU list and the
+ * counts and is only ever taken with a shard lock already held.  Eviction works from the LRU
+ * end and passes over nodes whose shard is busy rather than wait for it.
+ * A node is one block holding the CNODE followed by its name and its data.
+ *
+ * Zone cache data is packed (see mydns_rr_pack()) and handed to tasks as it is, never copied
+ * or changed.  A node counts the tasks using its data under its shard lock; a node removed
+ * from the cache while in use is only marked dead and the last task to let go frees it.
+ */
+#define SHARD_LOCK(C, s)	do { if ((C)->shared) mydns_lock(&(C)->locks[(s)]); } while (0)
+#define SHARD_UNLOCK(C, s)	do { if ((C)->shared) mydns_unlock(&(C)->locks[(s)]); } while (0)
+#define SHARD_TRYLOCK(C, s)	(!(C)->shared || mydns_trylock(&(C)->locks[(s)]))
+#define CACHE_LOCK(C)		do { if ((C)->shared) mydns_lock(&(C)->lock); } while (0)
+#define CACHE_UNLOCK(C)		do { if ((C)->shared) mydns_unlock(&(C)->lock); } while (0)
+#define CACHE_COUNT(C, F)	((C)->shared ? mydns_atomic_inc((C)->F) : (C)->F++)
+
+#define CACHE_SHARD(C, h)	((C)->shard_bits ? (uint32_t)(h) >> (32 - (C)->shard_bits) : 0)
+#define CACHE_HOME(C, h)	((uint32_t)(h) & ((C)->slots - 1))
+#define CACHE_SLOTS(C, s)	((C)->table + (size_t)(s) * (C)->slots)
+
+#define CACHE_ALIGN(n)		(((n) + 7) & ~(size_t)7)
+#define CACHE_NODE_SIZE(len)	CACHE_ALIGN(sizeof(CNODE) + (len) + 1)
+
+#define CACHE_EVICT_TRIES	8					/* Busy LRU nodes passed over before giving up */
+#define CACHE_MIN_SLOTS		16					/* Smallest shard */
+
+/* Hash used by every cache and its seed, chosen once by cache_init() */
+static cache_hash_t	cache_hash_type = CACHE_HASH_WYHASH;
+static uint64_t		cache_seed = 0;
 
 
 /**************************************************************************************************
@@ -60,70 +87,38 @@ isprime(unsigned int number) {
 	Create, initialize, and return a new CACHE structure.
 **************************************************************************************************/
 static CACHE *
-_cache_init(uint32_t limit, uint32_t expire, const char *desc) {
-  CACHE *C = NULL;
+_cache_init(uint32_t limit, uint32_t expire, const char *desc, int shared) {
+  CACHE		*C = NULL;
+  uint32_t	want = 0;
 
-  C = ALLOCATE(sizeof(CACHE), CACHE);
+  C = shared ? ALLOCATE_SHARED(sizeof(CACHE), CACHE, 0) : ALLOCATE(sizeof(CACHE), CACHE);
+  C->shared = shared;
   C->limit = limit;
   C->expire = expire;
 
-#if (HASH_TYPE == ORIGINAL_HASH) || (HASH_TYPE == ADDITIVE_HASH)
-  /* Make `slots' prime */
-  C->slots = limit * CACHE_SLOT_MULTIPLIER;
-  C->slots |= 1;
-  while (!isprime(C->slots))
-    C->slots += 2;
-#elif (HASH_TYPE == ROTATING_HASH) || (HASH_TYPE == FNV_HASH)
-  /* Make `slots' a power of two */
-  {
-    int		bits = 0;
-    uint32_t	slots = 0;
-
-    C->slots = limit * CACHE_SLOT_MULTIPLIER;
-    for (slots = C->slots, bits = 0; slots != 1; ) {
-      slots >>= 1;
-      bits++;
-    }
-    if (C->slots & ((1 << bits) - 1))
-      bits++;
-    slots = 1 << bits;
+  /* Shared caches are split so that servers working on different names rarely wait */
+  C->shards = shared ? CACHE_SHARDS : 1;
+  for (C->shard_bits = 0; ((uint32_t)1 << C->shard_bits) < C->shards; C->shard_bits++)
+    /* nothing */ ;
 
-    C->slots = slots;
-#if (HASH_TYPE == ROTATING_HASH)
-    C->mask = C->slots - 1;
-#endif
-#if (HASH_TYPE == FNV_HASH)
-    /* A 16-bit hash lets us use XOR instead of MOD to clamp the value - very fast */
-    if (C->slots < 65536)
-      C->slots = 65536;
-    for (C->bits = 0; C->bits < 32; C->bits++)
-      if (((uint32_t)1 << C->bits) == C->slots)
-	break;
-#endif
+  /* Make `slots' a power of two */
+  want = (uint32_t)(((uint64_t)limit * CACHE_SLOT_MULTIPLIER + C->shards - 1) / C->shards);
+  for (C->slots = CACHE_MIN_SLOTS; C->slots < want; C->slots <<= 1)
+    /* nothing */ ;
+
+  if (shared) {
+    C->table = ALLOCATE_N_SHARED((size_t)C->shards * C->slots, sizeof(CSLOT), CSLOT, 0);
+    C->used = ALLOCATE_N_SHARED(C->shards, sizeof(uint32_t), uint32_t, 0);
+    C->locks = ALLOCATE_N_SHARED(C->shards, sizeof(mydns_lock_t), mydns_lock_t, 0);
+  } else {
+    C->table = ALLOCATE_N((size_t)C->shards * C->slots, sizeof(CSLOT), CSLOT);
+    C->used = ALLOCATE_N(C->shards, sizeof(uint32_t), uint32_t);
   }
-#else
-#	error Hash method unknown or unspecified
-#endif
-
-  C->nodes = ALLOCATE_N(C->slots, sizeof(CNODE *), CNODE *);
 
 #if DEBUG_ENABLED && DEBUG_CACHE
-#if (HASH_TYPE == ORIGINAL_HASH)
-  DebugX("cache", 1, _("%s cache initialized (%u nodes, %u elements max) (original hash)"),
-	 desc, C->slots, limit);
-#elif (HASH_TYPE == ADDITIVE_HASH)
-  DebugX("cache", 1, _("%s cache initialized (%u nodes, %u elements max) (additive hash)"),
-	 desc, C->slots, limit);
-#elif (HASH_TYPE == ROTATING_HASH)
-  DebugX("cache", 1, _("%s cache initialized (%u nodes, %u elements max) (rotating hash)"),
-	 desc, C->slots, limit);
-#elif (HASH_TYPE == FNV_HASH)
-  DebugX("cache", 1, _("%s cache initialized (%u nodes, %u elements max) (%d-bit FNV hash)"),
-	 desc, C->slots, limit,
-	 C->bits);
-#else
-#	error Hash method unknown or unspecified
-#endif
+  DebugX("cache", 1, _("%s cache initialized (%u shards of %u slots, %u elements max) (%s hash)"),
+	 desc, C->shards, C->slots, limit,
+	 cache_hash_type == CACHE_HASH_CRC32C ? "crc32c" : cache_hash_type == CACHE_HASH_FNV ? "fnv" : "wyhash");
 #endif
 
   strncpy(C->name, desc, sizeof(C->name)-1);
@@ -132,15 +127,66 @@ _cache_init(uint32_t limit, uint32_t expire, const char *desc) {
 /*--- _cache_init() -----------------------------------------------------------------------------*/
 
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define HAVE_CRC32C_INSN 1
+#endif
+
+/**************************************************************************************************
+	_CACHE_HASH_SETUP
+	Pick the hash function named by the `cache-hash' option and a random seed, so the slots
+	names land in can't be worked out from outside.
+**************************************************************************************************/
+static void
+_cache_hash_setup(void) {
+  const char	*wanted = conf_get(&Conf, "cache-hash", NULL);
+  int		fd = -1;
+
+  if (!wanted || !wanted[0] || !strcasecmp(wanted, "auto") || !strcasecmp(wanted, "wyhash"))
+    cache_hash_type = CACHE_HASH_WYHASH;
+  else if (!strcasecmp(wanted, "fnv"))
+    cache_hash_type = CACHE_HASH_FNV;
+  else if (!strcasecmp(wanted, "crc32c")) {
+#if HAVE_CRC32C_INSN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+      cache_hash_type = CACHE_HASH_CRC32C;
+    else
+#endif
+    {
+      Warnx(_("no CRC32C instruction on this CPU - using wyhash for the caches"));
+      cache_hash_type = CACHE_HASH_WYHASH;
+    }
+  } else {
+    Warnx(_("unknown cache-hash `%s' - using wyhash"), wanted);
+    cache_hash_type = CACHE_HASH_WYHASH;
+  }
+
+  if ((fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+    if (read(fd, &cache_seed, sizeof(cache_seed)) != sizeof(cache_seed))
+      cache_seed = 0;
+    close(fd);
+  }
+  if (!cache_seed)
+    cache_seed = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ (uint64_t)(size_t)&fd;
+}
+/*--- _cache_hash_setup() -----------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	CACHE_INIT
 	Create the caches used by MyDNS.
+	If `shared' is nonzero the caches are to be used by several servers and are put in shared
+	memory (unless disabled by `shared-cache').  If `threaded' is nonzero the servers are
+	threads of this process, the caches have to be shared and locked whatever the config says.
 **************************************************************************************************/
 void
-cache_init(void) {
+cache_init(int shared, int threaded) {
   uint32_t	cache_size = 0, zone_cache_size = 0, reply_cache_size = 0;
   int		defaulted = 0;
   int		zone_cache_expire = 0, reply_cache_expire = 0;
+  size_t	shared_memory = 0;
+
+  _cache_hash_setup();
 
   /* Get ZoneCache size */
   zone_cache_size = atou(conf_get(&Conf, "zone-cache-size", &defaulted));
@@ -162,15 +208,35 @@ cache_init(void) {
   if (defaulted)
     reply_cache_expire = atou(conf_get(&Conf, "cache-expire", NULL)) / 2;
 
+  /* Create the shared memory the caches live in */
+  if ((shared || threaded) && (zone_cache_size || reply_cache_size)
+      && (threaded || GETBOOL(conf_get(&Conf, "shared-cache", NULL)))) {
+    shared = 1;
+    shared_memory = (size_t)atou(conf_get(&Conf, "shared-memory", NULL)) << 20;
+    if (mydns_shared_init(shared_memory) < 0) {
+      if (threaded)
+	Errx(_("unable to create %u MB of shared cache memory for the server threads"),
+	     (unsigned int)(shared_memory >> 20));
+      Warnx(_("unable to create %u MB of shared cache memory - each server will have its own cache"),
+	    (unsigned int)(shared_memory >> 20));
+      shared = 0;
+    }
+#if DEBUG_ENABLED && DEBUG_CACHE
+    else
+      DebugX("cache", 1, _("caches are shared between servers (%u MB)"), (unsigned int)(shared_memory >> 20));
+#endif
+  } else
+    shared = 0;
+
   /* Initialize caches */
   if (zone_cache_size)
-    ZoneCache = _cache_init(zone_cache_size, zone_cache_expire, "zone");
+    ZoneCache = _cache_init(zone_cache_size, zone_cache_expire, "zone", shared);
 #if USE_NEGATIVE_CACHE
   if (zone_cache_size)
-    NegativeCache = _cache_init(zone_cache_size, zone_cache_expire, "negative");
+    NegativeCache = _cache_init(zone_cache_size, zone_cache_expire, "negative", shared);
 #endif
   if (reply_cache_size)
-    ReplyCache = _cache_init(reply_cache_size, reply_cache_expire, "reply");
+    ReplyCache = _cache_init(reply_cache_size, reply_cache_expire, "reply", shared);
 }
 /*--- cache_init() ------------------------------------------------------------------------------*/
 
@@ -181,27 +247,22 @@ cache_init(void) {
 **************************************************************************************************/
 static void
 cache_size_update(CACHE *C) {
-  register uint n = 0;
+  register uint s = 0, n = 0;
   register CNODE *N = NULL;
 
   C->size = 0;
   C->size += sizeof(CACHE);
+  C->size += (size_t)C->shards * C->slots * sizeof(CSLOT);
 
   /* Get size of all data in cache */
-  for (n = 0; n < C->slots; n++)
-    for (N = C->nodes[n]; N; N = N->next_node) {
-      C->size += sizeof(CNODE);
-
-      if (C == ZoneCache) {
-	if (N->data) {
-	  if (N->type == DNS_QTYPE_SOA)
-	    C->size += mydns_soa_size((MYDNS_SOA *)N->data);
-	  else
-	    C->size += mydns_rr_size((MYDNS_RR *)N->data);
-	}
-      } else 
-	C->size += N->datalen;
+  for (s = 0; s < C->shards; s++) {
+    SHARD_LOCK(C, s);
+    for (n = 0; n < C->slots; n++) {
+      if ((N = CACHE_SLOTS(C, s)[n].node))
+	C->size += CACHE_NODE_SIZE(N->namelen) + N->datalen;
     }
+    SHARD_UNLOCK(C, s);
+  }
 }
 /*--- cache_size_update() -----------------------------------------------------------------------*/
 
@@ -209,26 +270,30 @@ cache_size_update(CACHE *C) {
 /**************************************************************************************************
 	CACHE_STATUS
 	Called when SIGUSR1 is received, returns a string to append to status.
+	Nodes that are not in the first slot probed for them are counted as collisions.
 **************************************************************************************************/
 void
 cache_status(CACHE *C) {
   if (C) {
-    register uint ct = 0, collisions = 0;
-    register CNODE *n = NULL;
+    register uint s = 0, ct = 0, collisions = 0;
+    register CSLOT *slot = NULL;
 
     /* Update cache size (bytes) */
     cache_size_update(C);
 
     /* Count number of collisions */
-    for (ct = collisions = 0; ct < C->slots; ct++)
-      if (C->nodes[ct] && C->nodes[ct]->next_node)
-	for (n = C->nodes[ct]->next_node; n; n = n->next_node)
+    for (s = 0; s < C->shards; s++) {
+      SHARD_LOCK(C, s);
+      for (ct = 0, slot = CACHE_SLOTS(C, s); ct < C->slots; ct++, slot++)
+	if (slot->node && CACHE_HOME(C, slot->hash) != ct)
 	  collisions++;
+      SHARD_UNLOCK(C, s);
+    }
 
-    Notice(_("%s cache %.0f%% useful (%u hits, %u misses),"
+    Notice(_("%s%s cache %.0f%% useful (%u hits, %u misses),"
 	     " %u collisions (%.0f%%), %.0f%% full (%u records), %u bytes, avg life %u sec"),
-	   C->name, PCT(C->questions, C->hits), C->hits, C->misses,
-	   collisions, PCT(C->slots, collisions),
+	   C->shared ? _("shared ") : "", C->name, PCT(C->questions, C->hits), C->hits, C->misses,
+	   collisions, PCT(C->count, collisions),
 	   PCT(C->limit, C->count), (uint)C->count, (uint)C->size,
 	   (uint)(C->removed
 		  ? (uint)C->removed_secs / C->removed
@@ -291,45 +356,231 @@ mrulist_del(CACHE *ThisCache, CNODE *n) {
 /*--- mrulist_del() -----------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	MRULIST_TOUCH
+	Moves a node that has just been used to the head of the MRU list.
+**************************************************************************************************/
+static void
+mrulist_touch(CACHE *ThisCache, CNODE *n) {
+  CACHE_LOCK(ThisCache);
+  mrulist_del(ThisCache, n);
+  mrulist_add(ThisCache, n);
+  CACHE_UNLOCK(ThisCache);
+}
+/*--- mrulist_touch() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_CACHE_SLOT_REMOVE
+	Takes a node out of its shard's table, moving the nodes probed after it back so that no
+	lookup stops short of them.  The caller holds the lock of the shard.
+	Returns -1 if the node is not in the table.
+**************************************************************************************************/
+static int
+_cache_slot_remove(CACHE *ThisCache, uint32_t shard, CNODE *n) {
+  CSLOT		*slots = CACHE_SLOTS(ThisCache, shard);
+  uint32_t	mask = ThisCache->slots - 1;
+  uint32_t	i = 0, j = 0, home = 0, probes = 0;
+
+  for (i = CACHE_HOME(ThisCache, n->hash); slots[i].node != n; i = (i + 1) & mask)
+    if (!slots[i].node || ++probes > mask)
+      return (-1);
+
+  for (j = i; ; ) {
+    j = (j + 1) & mask;
+    if (!slots[j].node)
+      break;
+    home = CACHE_HOME(ThisCache, slots[j].hash);
+    /* Move it into the hole unless its home slot lies cyclically in (i, j] */
+    if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j)) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i].node = NULL;
+  slots[i].hash = 0;
+  ThisCache->used[shard]--;
+  return (0);
+}
+/*--- _cache_slot_remove() ----------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	CACHE_FREE_NODE
 	Frees the node specified and removes it from the cache.
+	The caller holds the lock of shard `shard'.
 **************************************************************************************************/
 static void
-cache_free_node(CACHE *ThisCache, uint32_t hash, CNODE *n) {
-  register CNODE *prev = NULL, *cur = NULL, *next = NULL;
+cache_free_node(CACHE *ThisCache, uint32_t shard, CNODE *n) {
+  if (!n || shard >= ThisCache->shards)
+    return;
 
-  if (!n || hash >= ThisCache->slots)
+  if (_cache_slot_remove(ThisCache, shard, n) < 0)
+    Errx(_("tried to free invalid node %p in shard %u of cache"), n, shard);
+
+  CACHE_LOCK(ThisCache);
+  mrulist_del(ThisCache, n);					/* Remove from MRU/LRU list */
+  ThisCache->out++;
+  ThisCache->count--;
+  CACHE_UNLOCK(ThisCache);
+
+  /* Nodes still lent to tasks are freed by the last zone_cache_release() */
+  if (n->refs) {
+    n->dead = 1;
     return;
+  }
+  RELEASE(n);
+}
+/*--- cache_free_node() -------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	CACHE_EVICT
+	Removes the least recently used node to make room for a new one.  The caller holds the
+	lock of shard `held'; nodes in other shards that are busy are passed over.
+	Returns nonzero if a node was removed.
+**************************************************************************************************/
+static int
+cache_evict(CACHE *ThisCache, uint32_t held) {
+  register CNODE *n = NULL;
+  register int tries = 0;
+  uint32_t shard = 0;
+
+  CACHE_LOCK(ThisCache);
+  for (n = ThisCache->mruTail; n; n = n->mruPrev) {
+    shard = CACHE_SHARD(ThisCache, n->hash);
+    if (shard == held || SHARD_TRYLOCK(ThisCache, shard))
+      break;
+    if (++tries >= CACHE_EVICT_TRIES) {
+      n = NULL;
+      break;
+    }
+  }
+  if (!n) {
+    CACHE_UNLOCK(ThisCache);
+    return (0);
+  }
+  ThisCache->removed++;
+  ThisCache->removed_secs += current_time - n->insert_time;
+  CACHE_UNLOCK(ThisCache);
+
+  cache_free_node(ThisCache, shard, n);
+  if (shard != held)
+    SHARD_UNLOCK(ThisCache, shard);
+  return (1);
+}
+/*--- cache_evict() -----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	CACHE_NEW_NODE
+	Allocates a node for `name' with room for `datalen' octets of data, in a single block
+	holding the CNODE, then the name, then the data.  Nodes of shared caches are in shared
+	memory; if it is full the least recently used node is removed to make room.
+	The caller holds the lock of the shard of `hash'.  Returns NULL if there is no room.
+**************************************************************************************************/
+static CNODE *
+cache_new_node(CACHE *ThisCache, uint32_t hash, const void *name, size_t namelen, size_t datalen) {
+  CNODE *n = NULL;
+
+  if (!ThisCache->shared)
+    n = (CNODE *)ALLOCATE(CACHE_NODE_SIZE(namelen) + datalen, char[]);
+  else {
+    if (!(n = mydns_shared_alloc(CACHE_NODE_SIZE(namelen) + datalen))
+	&& cache_evict(ThisCache, CACHE_SHARD(ThisCache, hash)))
+      n = mydns_shared_alloc(CACHE_NODE_SIZE(namelen) + datalen);
+    if (!n)
+      return (NULL);
+  }
+  if (datalen)
+    n->data = (void *)((char *)n + CACHE_NODE_SIZE(namelen));
+
+  n->hash = hash;
+  n->name = (char *)(n + 1);
+  memcpy(n->name, name, namelen);
+  n->name[namelen] = '\0';
+  n->namelen = namelen;
+  return (n);
+}
+/*--- cache_new_node() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	CACHE_ADD_NODE
+	Puts a new node in its shard's table and at the head of the MRU list.  The caller holds
+	the lock of the node's shard.  Returns -1 if the shard is too full to take it.
+**************************************************************************************************/
+static int
+cache_add_node(CACHE *ThisCache, CNODE *n) {
+  uint32_t	shard = CACHE_SHARD(ThisCache, n->hash);
+  uint32_t	mask = ThisCache->slots - 1;
+  CSLOT		*slots = CACHE_SLOTS(ThisCache, shard);
+  uint32_t	i = 0;
+
+  /* Keep probes short - an unlucky shard stops taking nodes before it fills up */
+  if (ThisCache->used[shard] >= ThisCache->slots - (ThisCache->slots >> 3))
+    return (-1);
+
+  for (i = CACHE_HOME(ThisCache, n->hash); slots[i].node; i = (i + 1) & mask)
+    /* nothing */ ;
+  slots[i].hash = n->hash;
+  slots[i].node = n;
+  ThisCache->used[shard]++;
+
+  CACHE_LOCK(ThisCache);
+  ThisCache->count++;
+  mrulist_add(ThisCache, n);
+  CACHE_UNLOCK(ThisCache);
+  return (0);
+}
+/*--- cache_add_node() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_CACHE_SCAN
+	Frees every node of the cache for which `drop' returns nonzero.
+**************************************************************************************************/
+static void
+_cache_scan(CACHE *ThisCache, int (*drop)(CACHE *, CNODE *, uint32_t), uint32_t arg) {
+  register uint32_t	s = 0, ct = 0;
+  register CNODE	*n = NULL;
 
-  for (cur = ThisCache->nodes[hash]; cur; cur = next) {
-    next = cur->next_node;
-    if (cur == n) {						/* Delete this node */
-      mrulist_del(ThisCache, n);				/* Remove from MRU/LRU list */
-
-      /* Remove the node */
-      if (cur->datalen) {
-	RELEASE(cur->data);
-      }	else if (cur->type == DNS_QTYPE_SOA) {
-	mydns_soa_free(cur->data);
-      } else {
-	mydns_rr_free(cur->data);
+  if (!ThisCache) return;
+  for (s = 0; s < ThisCache->shards; s++) {
+    SHARD_LOCK(ThisCache, s);
+    for (ct = 0; ct < ThisCache->slots; ) {
+      n = CACHE_SLOTS(ThisCache, s)[ct].node;
+      if (n && drop(ThisCache, n, arg)) {
+	/* A later node may have moved back into this slot */
+	cache_free_node(ThisCache, s, n);
+	continue;
       }
+      ct++;
+    }
+    SHARD_UNLOCK(ThisCache, s);
+  }
+}
+/*--- _cache_scan() -----------------------------------------------------------------------------*/
 
-      if (cur == ThisCache->nodes[hash])			/* Head of node? */
-	ThisCache->nodes[hash] = cur->next_node;
-      else if (prev)
-	prev->next_node = cur->next_node;
-      RELEASE(cur);
-      ThisCache->out++;
-      ThisCache->count--;
-      return;
-    } else
-      prev = cur;
+
+static int
+_cache_drop_all(CACHE *ThisCache, CNODE *n, uint32_t arg) {
+  return (1);
+}
+
+static int
+_cache_drop_expired(CACHE *ThisCache, CNODE *n, uint32_t arg) {
+  if (n->expire && (current_time > n->expire)) {
+    CACHE_COUNT(ThisCache, expired);
+    return (1);
   }
-  Errx(_("tried to free invalid node %p at %u in cache"), n, hash);
+  return (0);
+}
+
+static int
+_cache_drop_zone(CACHE *ThisCache, CNODE *n, uint32_t zone) {
+  return (n->zone == zone);
 }
-/*--- cache_free_node() -------------------------------------------------------------------------*/
 
 
 /**************************************************************************************************
@@ -338,16 +589,7 @@ cache_free_node(CACHE *ThisCache, uint32_t hash, CNODE *n) {
 **************************************************************************************************/
 void
 cache_empty(CACHE *ThisCache) {
-  register uint		ct = 0;
-  register CNODE	*n = NULL, *tmp = NULL;
-
-  if (!ThisCache) return;
-  for (ct = 0; ct < ThisCache->slots; ct++)
-    for (n = ThisCache->nodes[ct]; n; n = tmp) {
-      tmp = n->next_node;
-      cache_free_node(ThisCache, ct, n);
-    }
-  ThisCache->mruHead = ThisCache->mruTail = NULL;
+  _cache_scan(ThisCache, _cache_drop_all, 0);
 }
 /*--- cache_empty() -----------------------------------------------------------------------------*/
 
@@ -358,19 +600,7 @@ cache_empty(CACHE *ThisCache) {
 **************************************************************************************************/
 void
 cache_cleanup(CACHE *ThisCache) {
-  register uint		ct = 0;
-  register CNODE	*n = NULL, *tmp = NULL;
-
-  if (!ThisCache)
-    return;
-  for (ct = 0; ct < ThisCache->slots; ct++)
-    for (n = ThisCache->nodes[ct]; n; n = tmp) {
-      tmp = n->next_node;
-      if (n->expire && (current_time > n->expire)) {
-	ThisCache->expired++;
-	cache_free_node(ThisCache, ct, n);
-      }
-    }
+  _cache_scan(ThisCache, _cache_drop_expired, 0);
 }
 /*--- cache_cleanup() ---------------------------------------------------------------------------*/
 
@@ -381,91 +611,246 @@ cache_cleanup(CACHE *ThisCache) {
 **************************************************************************************************/
 void
 cache_purge_zone(CACHE *ThisCache, uint32_t zone) {
-  register uint		ct = 0;
-  register CNODE	*n = NULL, *tmp = NULL;
-
-  if (!ThisCache)
-    return;
-  for (ct = 0; ct < ThisCache->slots; ct++)
-    for (n = ThisCache->nodes[ct]; n; n = tmp) {
-      tmp = n->next_node;
-      if (n->zone == zone)
-	cache_free_node(ThisCache, ct, n);
-    }
+  _cache_scan(ThisCache, _cache_drop_zone, zone);
 }
 /*--- cache_purge_zone() ------------------------------------------------------------------------*/
 
 
-/**************************************************************************************************
-	CACHE_HASH
-	Returns hash value.
-**************************************************************************************************/
-static inline uint32_t
-cache_hash(CACHE *ThisCache, uint32_t initval, void *buf, register size_t buflen) {
-  unsigned char *bufp = buf;
-#if (HASH_TYPE == ORIGINAL_HASH)
-  register uint32_t	hash = 0;
-  register unsigned char *p = NULL;
-
-  /* Generate hash value */
-  for (hash = initval, p = bufp; p < (bufp + buflen); p++) {
-    register int tmp = 0;
-    hash = (hash << 4) + (*p);
-    if ((tmp = (hash & 0xf0000000))) {
-      hash = hash ^ (tmp >> 24);
-      hash = hash ^ tmp;
-    }
+/*
+ * Hash functions.  Each takes the seed (already mixed with the zone/type of the question)
+ * and the name, and returns 32 bits; the top bits pick the shard and the bottom bits the slot.
+ */
+#define WY_P0	0xa0761d6478bd642fULL
+#define WY_P1	0xe7037ed1a0b428dbULL
+#define WY_P2	0x8ebc6af09c88c6e3ULL
+
+static inline uint64_t
+_wy_read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v);
+}
+
+static inline uint64_t
+_wy_read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v);
+}
+
+/* 64x64 bit multiply, folding the high half of the product into the low half */
+static inline uint64_t
+_wy_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)a * b;
+  return ((uint64_t)r ^ (uint64_t)(r >> 64));
+#else
+  uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), lo = 0, c = (t < rl);
+
+  lo = t + (rm1 << 32);
+  c += (lo < t);
+  return (lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c));
+#endif
+}
+
+static uint32_t
+_cache_hash_wyhash(uint64_t seed, const unsigned char *p, size_t len) {
+  uint64_t	a = 0, b = 0, h = 0;
+  size_t	left = len;
+
+  seed ^= WY_P0;
+  for (; left > 16; left -= 16, p += 16)
+    seed = _wy_mum(_wy_read64(p) ^ WY_P1, _wy_read64(p + 8) ^ seed);
+
+  if (left >= 8) {
+    a = _wy_read64(p);
+    b = _wy_read64(p + left - 8);
+  } else if (left >= 4) {
+    a = _wy_read32(p);
+    b = _wy_read32(p + left - 4);
+  } else if (left) {
+    a = ((uint64_t)p[0] << 16) | ((uint64_t)p[left >> 1] << 8) | p[left - 1];
   }
-  return (hash % ThisCache->slots);
-#elif (HASH_TYPE == ADDITIVE_HASH)
-  register uint32_t	hash = 0;
-  register unsigned char *p = NULL;
-
-  for (hash = initval, p = bufp; p < (bufp + buflen); p++)
-    hash += *p;
-  return (hash % ThisCache->slots);
-#elif (HASH_TYPE == ROTATING_HASH)
-  register uint32_t	hash = 0;
-  register unsigned char *p = NULL;
-
-  for (hash = initval, p = buf; p < (buf + buflen); p++)
-    hash = (hash << 4) ^ (hash >> 28) ^ (*p);
-  return ((hash ^ (hash>>10) ^ (hash>>20)) & ThisCache->mask);
-#elif (HASH_TYPE == FNV_HASH)
-  register uint32_t	hash = FNV_32_INIT;
-  unsigned char *bp = bufp;
-  unsigned char *be = bp + buflen;
+  h = _wy_mum(WY_P1 ^ len, _wy_mum(a ^ WY_P1, b ^ seed) ^ WY_P2);
+  return ((uint32_t)(h ^ (h >> 32)));
+}
+
+#if HAVE_CRC32C_INSN
+__attribute__((target("sse4.2")))
+static uint32_t
+_cache_hash_crc32c(uint64_t seed, const unsigned char *p, size_t len) {
+  uint32_t	crc = (uint32_t)seed, h = 0;
+  size_t	left = len;
+
+#if defined(__x86_64__)
+  for (; left >= 8; left -= 8, p += 8)
+    crc = (uint32_t)__builtin_ia32_crc32di(crc, _wy_read64(p));
+#endif
+  for (; left >= 4; left -= 4, p += 4)
+    crc = __builtin_ia32_crc32si(crc, (uint32_t)_wy_read32(p));
+  for (; left; left--, p++)
+    crc = __builtin_ia32_crc32qi(crc, *p);
+
+  /* CRC bits are linear in the input; mix them so the shard bits depend on all of it */
+  h = crc ^ (uint32_t)(seed >> 32) ^ (uint32_t)len;
+  h ^= h >> 16; h *= 0x85ebca6b;
+  h ^= h >> 13; h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return (h);
+}
+#endif
+
+static uint32_t
+_cache_hash_fnv(uint64_t seed, const unsigned char *bp, size_t len) {
+  register uint32_t	hash = FNV_32_INIT ^ (uint32_t)seed;
+  const unsigned char	*be = bp + len;
 
   while (bp < be) {
     hash *= FNV_32_PRIME;
     hash ^= (uint32_t)*bp++;
   }
   hash *= FNV_32_PRIME;
-  hash ^= (uint32_t)initval;
+  hash ^= (uint32_t)(seed >> 32);
+  return (hash ^ (hash >> 16) ^ (hash << 15));
+}
 
-  if (ThisCache->bits == 16)
-    return ((hash >> 16) ^ (hash & (((uint32_t)1 << 16) - 1)));
-  else
-    return (hash % ThisCache->slots);
-#else
-#	error Hash method unknown or unspecified
+
+/**************************************************************************************************
+	CACHE_HASH
+	Returns hash value.
+**************************************************************************************************/
+static inline uint32_t
+cache_hash(uint32_t initval, const void *buf, size_t buflen) {
+  uint64_t	seed = cache_seed ^ _wy_mum((uint64_t)initval ^ WY_P2, WY_P0);
+
+  switch (cache_hash_type) {
+#if HAVE_CRC32C_INSN
+  case CACHE_HASH_CRC32C:	return _cache_hash_crc32c(seed, buf, buflen);
 #endif
+  case CACHE_HASH_FNV:		return _cache_hash_fnv(seed, buf, buflen);
+  default:			return _cache_hash_wyhash(seed, buf, buflen);
+  }
 }
 /*--- cache_hash() ------------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	_CACHE_LOOKUP
+	Find the live node for a name in a cache and move it to the head of the usefulness list.
+	Reply cache nodes are matched on protocol, the others on zone.  Expired nodes are freed
+	on the way.  The caller holds the lock of the shard of `hash'.  Returns NULL if not found.
+**************************************************************************************************/
+static CNODE *
+_cache_lookup(CACHE *ThisCache, uint32_t hash, uint32_t zone, dns_qtype_t type, int protocol,
+	      const void *name, size_t namelen) {
+  uint32_t	shard = CACHE_SHARD(ThisCache, hash), mask = ThisCache->slots - 1;
+  CSLOT		*slots = CACHE_SLOTS(ThisCache, shard);
+  uint32_t	i = 0, probes = 0;
+  register CNODE *n = NULL;
+
+  for (i = CACHE_HOME(ThisCache, hash); (n = slots[i].node); i = (i + 1) & mask) {
+    if (++probes > ThisCache->slots)
+      break;
+    if (slots[i].hash != hash)
+      continue;
+    if ((n->namelen == namelen) && (n->type == type)
+	&& ((ThisCache == ReplyCache) ? (n->protocol == protocol) : (n->zone == zone))
+	&& !memcmp(n->name, name, namelen)) {
+      /* Is the node expired? */
+      if (n->expire && (current_time > n->expire)) {
+	cache_free_node(ThisCache, shard, n);
+	return (NULL);
+      }
+
+      /* Found in cache; move to head of usefulness list */
+      mrulist_touch(ThisCache, n);
+      return (n);
+    }
+  }
+  return (NULL);
+}
+/*--- _cache_lookup() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_ZONE_CACHE_LEND
+	Records that the task is using `data', which belongs to zone cache node `n' (already
+	referenced by the caller) or, if `n' is NULL, was loaded for the task alone.
+	Either way it is given back by zone_cache_release() when the task is done.  Returns `data'.
+**************************************************************************************************/
+static void *
+_zone_cache_lend(TASK *t, CNODE *n, void *data, int is_soa) {
+  ZONEREF *ref = NULL;
+
+  if (!data)
+    return (NULL);
+
+  if (t->numZoneRefs == t->maxZoneRefs) {
+    t->maxZoneRefs = t->maxZoneRefs ? t->maxZoneRefs * 2 : 8;
+    t->ZoneRefs = REALLOCATE(t->ZoneRefs, t->maxZoneRefs * sizeof(ZONEREF), ZONEREF[]);
+  }
+  ref = &t->ZoneRefs[t->numZoneRefs++];
+  ref->node = n;
+  ref->data = data;
+  ref->soa = is_soa;
+  return (data);
+}
+/*--- _zone_cache_lend() ------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	ZONE_CACHE_RELEASE
+	Gives back every record zone_cache_find() handed to the task.  Records loaded for the task
+	alone are freed; cache nodes lose a reference, and those removed from the cache meanwhile
+	are freed with their last reference.
+**************************************************************************************************/
+void
+zone_cache_release(TASK *t) {
+  unsigned int	i = 0;
+  uint32_t	shard = 0;
+  ZONEREF	*ref = NULL;
+  CNODE		*n = NULL;
+
+  for (i = 0; i < t->numZoneRefs; i++) {
+    ref = &t->ZoneRefs[i];
+    if ((n = ref->node)) {
+      shard = CACHE_SHARD(ZoneCache, n->hash);
+      SHARD_LOCK(ZoneCache, shard);
+      if (!--n->refs && n->dead)
+	RELEASE(n);
+      SHARD_UNLOCK(ZoneCache, shard);
+    } else if (ref->soa) {
+      mydns_soa_free(ref->data);
+    } else {
+      mydns_rr_free(ref->data);
+    }
+  }
+  t->numZoneRefs = 0;
+}
+/*--- zone_cache_release() ----------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	ZONE_CACHE_FIND
 	Returns the SOA/RR from cache (or via the database) or NULL if `name' doesn't match.
+	The records are lent to task `t' until zone_cache_release(); the caller must neither
+	change nor free them.
 **************************************************************************************************/
+/* Records from the database that did not go in the cache stay with the task */
+#define ZONE_CACHE_OWN() \
+  ((type == DNS_QTYPE_SOA) ? _zone_cache_lend(t, NULL, soa, 1) : _zone_cache_lend(t, NULL, rr, 0))
+
 void *
 zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
 		const char *name, size_t namelen, int *errflag, MYDNS_SOA *parent) {
-  register uint32_t	hash = 0;
+  register uint32_t	hash = 0, shard = 0, i = 0;
   register CNODE	*n = NULL;
   MYDNS_SOA		*soa = NULL;
   MYDNS_RR		*rr = NULL;
   CACHE			*C = NULL;			/* Which cache to use when inserting */
+  size_t		datalen = 0;			/* Packed size of the data */
 
   *errflag = 0;
 
@@ -478,61 +863,32 @@ zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
 #endif
 
   if (ZoneCache) {
-    hash = cache_hash(ZoneCache, zone + type, (void*)name, namelen);
+    hash = cache_hash(zone + type, name, namelen);
 #if USE_NEGATIVE_CACHE
     /* Check negative reply cache */
     if (NegativeCache) {
-      NegativeCache->questions++;
-
-      /* Look at the appropriate node.  Descend list and find match. */
-      for (n = NegativeCache->nodes[hash]; n; n = n->next_node)
-	if ((n->namelen == namelen) && (n->zone == zone) && (n->type == type)) {
-	  if (!n->name)
-	    Errx(_("negative cache node %p at hash %u has NULL name"), n, hash);
-	  if (!memcmp(n->name, name, namelen)) {
-	    /* Is the node expired? */
-	    if (n->expire && (current_time > n->expire)) {
-	      cache_free_node(NegativeCache, hash, n);
-	      break;
-	    }
-	    NegativeCache->hits++;
-
-	    /* Found in cache; move to head of usefulness list */
-	    mrulist_del(NegativeCache, n);
-	    mrulist_add(NegativeCache, n);
-	    return NULL;
-	  }
-	}
-      NegativeCache->misses++;
+      CACHE_COUNT(NegativeCache, questions);
+      SHARD_LOCK(NegativeCache, CACHE_SHARD(NegativeCache, hash));
+      n = _cache_lookup(NegativeCache, hash, zone, type, 0, name, namelen);
+      SHARD_UNLOCK(NegativeCache, CACHE_SHARD(NegativeCache, hash));
+      if (n) {
+	CACHE_COUNT(NegativeCache, hits);
+	return NULL;
+      }
+      CACHE_COUNT(NegativeCache, misses);
     }
 #endif
 
     /* Not in negative cache, so look in zone cache */
-    ZoneCache->questions++;
-
-    /* Look at the appropriate node.  Descend list and find match. */
-    for (n = ZoneCache->nodes[hash]; n; n = n->next_node) {
-      if ((n->namelen == namelen) && (n->zone == zone) && (n->type == type)) {
-	if (!n->name)
-	  Errx(_("zone cache node %p at hash %u has NULL name"), n, hash);
-	if (!memcmp(n->name, name, namelen)) {
-	  /* Is the node expired? */
-	  if (n->expire && (current_time > n->expire)) {
-	    cache_free_node(ZoneCache, hash, n);
-	    break;
-	  }
-	  ZoneCache->hits++;
-
-	  /* Found in cache; move to head of usefulness list */
-	  mrulist_del(ZoneCache, n);
-	  mrulist_add(ZoneCache, n);
-	  if (type == DNS_QTYPE_SOA)
-	    return (n->data ? mydns_soa_dup(n->data, 1) : NULL);
-	  else
-	    return (n->data ? mydns_rr_dup(n->data, 1) : NULL);
-	}
-      }
+    CACHE_COUNT(ZoneCache, questions);
+    SHARD_LOCK(ZoneCache, CACHE_SHARD(ZoneCache, hash));
+    if ((n = _cache_lookup(ZoneCache, hash, zone, type, 0, name, namelen))) {
+      CACHE_COUNT(ZoneCache, hits);
+      n->refs++;
+      SHARD_UNLOCK(ZoneCache, CACHE_SHARD(ZoneCache, hash));
+      return _zone_cache_lend(t, n, n->data, type == DNS_QTYPE_SOA);
     }
+    SHARD_UNLOCK(ZoneCache, CACHE_SHARD(ZoneCache, hash));
   }
 
   /* Result not found in cache; Get answer from database */
@@ -560,11 +916,11 @@ zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
 #else
       if (!(soa && (C = ZoneCache)))
 #endif
-	return ((void *)soa);
+	return _zone_cache_lend(t, NULL, soa, 1);
 
     /* Don't cache if TTL is 0 */
     if (soa && !soa->ttl)
-      return ((void *)soa);
+      return _zone_cache_lend(t, NULL, soa, 1);
   } else {
 #if DEBUG_ENABLED && DEBUG_SQL_QUERIES
     DebugX("cache", 1, _("%s: SQL query: table \"%s\", zone=%u,type=\"%s\",name=\"%s\""),
@@ -592,37 +948,53 @@ zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
 #else
       if (!(rr && (C = ZoneCache)))
 #endif
-	return ((void *)rr);
+	return _zone_cache_lend(t, NULL, rr, 0);
 
     /* Don't cache if TTL of this RR (or the parent SOA) is 0 */
     if ((rr && !rr->ttl) || (parent && !parent->ttl))
-      return ((void *)rr);
+      return _zone_cache_lend(t, NULL, rr, 0);
+  }
+  CACHE_COUNT(C, misses);
+
+  shard = CACHE_SHARD(C, hash);
+  SHARD_LOCK(C, shard);
+
+  /* Another server may have added the same name while we were asking the database */
+  if (C->shared) {
+    for (n = NULL, i = CACHE_HOME(C, hash); CACHE_SLOTS(C, shard)[i].node; i = (i + 1) & (C->slots - 1))
+      if (CACHE_SLOTS(C, shard)[i].hash == hash) {
+	n = CACHE_SLOTS(C, shard)[i].node;
+	if ((n->namelen == namelen) && (n->zone == zone) && (n->type == type)
+	    && !memcmp(n->name, name, namelen))
+	  break;
+	n = NULL;
+      }
+    if (n) {
+      SHARD_UNLOCK(C, shard);
+      return ZONE_CACHE_OWN();
+    }
   }
-  C->misses++;
 
   /* If the cache is full, delete the least recently used node and add new node */
-  if (C->count >= C->limit) {
-    if (C->mruTail) {
-      C->removed++;
-      C->removed_secs += current_time - C->mruTail->insert_time;
-      cache_free_node(C, C->mruTail->hash, C->mruTail);
-    } else {
-      return (type == DNS_QTYPE_SOA ? (void *)soa : (void *)rr);
-    }
+  if (C->count >= C->limit && !cache_evict(C, shard)) {
+    SHARD_UNLOCK(C, shard);
+    return ZONE_CACHE_OWN();
   }
 
-  /* Add to cache */
-  C->in++;
-  n = ALLOCATE(sizeof(CNODE), CNODE);
-  n->hash = hash;
+  /* Add to cache - zone data is packed into the node, which tasks then share */
+  if (C == ZoneCache)
+    datalen = (type == DNS_QTYPE_SOA) ? mydns_soa_size(soa) : mydns_rr_size(rr);
+  if (!(n = cache_new_node(C, hash, name, namelen, datalen))) {
+    SHARD_UNLOCK(C, shard);
+    return ZONE_CACHE_OWN();
+  }
   n->zone = zone;
   n->type = type;
-  strncpy(n->name, name, sizeof(n->name)-1);
-  n->namelen = namelen;
+  n->datalen = datalen;
   n->insert_time = current_time;
   if (type == DNS_QTYPE_SOA) {
     if (C == ZoneCache)
-      n->data = mydns_soa_dup(soa, 1);
+      n->data = mydns_soa_pack(soa, n->data);
 
     if (soa && (soa->ttl < (uint32_t)C->expire))
       n->expire = current_time + soa->ttl;
@@ -630,23 +1002,36 @@ zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
       n->expire = current_time + C->expire;
   } else {
     if (C == ZoneCache)
-      n->data = mydns_rr_dup(rr, 1);
+      n->data = mydns_rr_pack(rr, n->data);
 
     if (rr && (rr->ttl < (uint32_t)C->expire))
       n->expire = current_time + rr->ttl;
     else if (C->expire)
       n->expire = current_time + C->expire;
   }
-  n->next_node = C->nodes[hash];
-
-  /* Add node to cache */
-  C->nodes[hash] = n;
-  C->count++;
 
-  /* Add node to head of MRU list */
-  mrulist_add(C, n);
+  /* Add node to cache and to head of MRU list */
+  if (cache_add_node(C, n) < 0) {
+    RELEASE(n);
+    SHARD_UNLOCK(C, shard);
+    return ZONE_CACHE_OWN();
+  }
+  CACHE_COUNT(C, in);
+
+  /* Hand out the cached copy and drop the one from the database */
+  if (C == ZoneCache && n->data) {
+    n->refs++;
+    SHARD_UNLOCK(C, shard);
+    if (type == DNS_QTYPE_SOA) {
+      mydns_soa_free(soa);
+    } else {
+      mydns_rr_free(rr);
+    }
+    return _zone_cache_lend(t, n, n->data, type == DNS_QTYPE_SOA);
+  }
+  SHARD_UNLOCK(C, shard);
 
-  return (type == DNS_QTYPE_SOA ? (void *)soa : (void *)rr);
+  return ZONE_CACHE_OWN();
 }
 /*--- zone_cache_find() --------------------------------------------------------------------------*/
 
@@ -659,7 +1044,7 @@ zone_cache_find(TASK *t, uint32_t zone, char *origin, dns_qtype_t type,
 **************************************************************************************************/
 int
 reply_cache_find(TASK *t) {
-  register uint32_t	hash = 0;
+  register uint32_t	hash = 0, shard = 0;
   register CNODE	*n = NULL;
   register void		*p = NULL;
 
@@ -672,71 +1057,100 @@ reply_cache_find(TASK *t) {
     return (0);
 #endif
 
-  hash = cache_hash(ReplyCache, t->qtype, (void*)t->qd, t->qdlen);
-  ReplyCache->questions++;
-
-  /* Look at the appropriate node.  Descend list and find match. */
-  for (n = ReplyCache->nodes[hash]; n; n = n->next_node) {
-    if ((n->namelen == t->qdlen) && (n->type == t->qtype) && (n->protocol == t->protocol)) {
-      if (!n->name)
-	Errx(_("reply cache node %p at hash %u has NULL name"), n, hash);
-      if (!memcmp(n->name, t->qd, t->qdlen)) {
-	/* Is the node expired? */
-	if (n->expire && (current_time > n->expire)) {
-	  cache_free_node(ReplyCache, hash, n);
-	  break;
-	}
+  hash = cache_hash(t->qtype, t->qd, t->qdlen);
+  shard = CACHE_SHARD(ReplyCache, hash);
+  CACHE_COUNT(ReplyCache, questions);
 
-	/* Found in cache; move to head of usefulness list */
-	mrulist_del(ReplyCache, n);
-	mrulist_add(ReplyCache, n);
+  SHARD_LOCK(ReplyCache, shard);
+  if (!(n = _cache_lookup(ReplyCache, hash, 0, t->qtype, t->protocol, t->qd, t->qdlen))) {
+    SHARD_UNLOCK(ReplyCache, shard);
+    CACHE_COUNT(ReplyCache, misses);
+    return (0);
+  }
 
-	/* Allocate space for reply data */
-	t->replylen = n->datalen - sizeof(DNS_HEADER) - sizeof(task_error_t);
-	t->reply = ALLOCATE(t->replylen, char[]);
-	p = n->data;
+  /* Allocate space for reply data */
+  t->replylen = n->datalen - sizeof(DNS_HEADER) - sizeof(task_error_t);
+  t->reply = ALLOCATE(t->replylen, char[]);
+  p = n->data;
 
-	/* Copy DNS header */
-	memcpy(&t->hdr, p, sizeof(DNS_HEADER));
-	p = (void*)((unsigned char *)p + sizeof(DNS_HEADER));
+  /* Copy DNS header */
+  memcpy(&t->hdr, p, sizeof(DNS_HEADER));
+  p = (void*)((unsigned char *)p + sizeof(DNS_HEADER));
 
-	/* Copy reason */
-	memcpy(&t->reason, p, sizeof(task_error_t));
-	p = (void*)((unsigned char *)p + sizeof(task_error_t));
+  /* Copy reason */
+  memcpy(&t->reason, p, sizeof(task_error_t));
+  p = (void*)((unsigned char *)p + sizeof(task_error_t));
 
-	/* Copy reply data */
-	memcpy(t->reply, p, t->replylen);
+  /* Copy reply data */
+  memcpy(t->reply, p, t->replylen);
 
-	/* Set count of records in each section */
-	p = t->reply + SIZE16 + SIZE16 + SIZE16;
-	DNS_GET16(t->an.size, p);
-	DNS_GET16(t->ns.size, p);
-	DNS_GET16(t->ar.size, p);
+  t->zone = n->zone;
+  SHARD_UNLOCK(ReplyCache, shard);
 
-	t->zone = n->zone;
+  /* Set count of records in each section */
+  p = t->reply + SIZE16 + SIZE16 + SIZE16;
+  DNS_GET16(t->an.size, p);
+  DNS_GET16(t->ns.size, p);
+  DNS_GET16(t->ar.size, p);
 
-	t->reply_from_cache = 1;
-	ReplyCache->hits++;
+  t->reply_from_cache = 1;
+  CACHE_COUNT(ReplyCache, hits);
 
-	return (1);
-      }
-    }
-  }
-  ReplyCache->misses++;
-  return (0);
+  return (1);
 }
 /*--- reply_cache_find() ------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	REPLY_CACHE_PEEK
+	Look up a question straight from the wire without a task.
+	If found copies the reply into `dest' (which holds `destsize' octets) and its header into
+	`hdr' and returns the length of the reply.  Returns 0 if not found or if it won't fit.
+	Misses are not counted, the task that the caller creates instead will count them.
+**************************************************************************************************/
+size_t
+reply_cache_peek(dns_qtype_t qtype, int protocol, unsigned char *qd, size_t qdlen,
+		 char *dest, size_t destsize, DNS_HEADER *hdr) {
+  register uint32_t	hash = 0, shard = 0;
+  register CNODE	*n = NULL;
+  size_t		replylen = 0;
+
+  if (!ReplyCache || qdlen > DNS_MAXPACKETLEN_UDP)
+    return (0);
+
+  hash = cache_hash(qtype, qd, qdlen);
+  shard = CACHE_SHARD(ReplyCache, hash);
+
+  SHARD_LOCK(ReplyCache, shard);
+  if ((n = _cache_lookup(ReplyCache, hash, 0, qtype, protocol, qd, qdlen))) {
+    replylen = n->datalen - sizeof(DNS_HEADER) - sizeof(task_error_t);
+    if (replylen <= destsize) {
+      memcpy(hdr, n->data, sizeof(DNS_HEADER));
+      memcpy(dest, (char *)n->data + sizeof(DNS_HEADER) + sizeof(task_error_t), replylen);
+    } else
+      replylen = 0;
+  }
+  SHARD_UNLOCK(ReplyCache, shard);
+
+  if (replylen) {
+    CACHE_COUNT(ReplyCache, questions);
+    CACHE_COUNT(ReplyCache, hits);
+  }
+  return (replylen);
+}
+/*--- reply_cache_peek() ------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	ADD_REPLY_TO_CACHE
 	Adds the current reply to the reply cache.
 **************************************************************************************************/
 void
 add_reply_to_cache(TASK *t) {
-  register uint32_t	hash = 0;
+  register uint32_t	hash = 0, shard = 0;
   register CNODE	*n = NULL;
   register void		*p = NULL;
+  size_t		datalen = 0;
 
   if (!ReplyCache || t->qdlen > DNS_MAXPACKETLEN_UDP || t->hdr.rcode == DNS_RCODE_SERVFAIL) {
     return;
@@ -756,53 +1170,37 @@ add_reply_to_cache(TASK *t) {
   if (forward_recursive && t->hdr.rcode != DNS_RCODE_NOERROR)
     return;
 
-  hash = cache_hash(ReplyCache, t->qtype, (void*)t->qd, t->qdlen);
+  hash = cache_hash(t->qtype, t->qd, t->qdlen);
+  shard = CACHE_SHARD(ReplyCache, hash);
 
-  /* Look at the appropriate node.  Descend list and find match. */
-  for (n = ReplyCache->nodes[hash]; n; n = n->next_node) {
-    if ((n->namelen == t->qdlen) && (n->type == t->qtype) && (n->protocol == t->protocol)) {
-      if (!n->name)
-	Errx(_("reply cache node %p at hash %u has NULL name"), n, hash);
+  SHARD_LOCK(ReplyCache, shard);
 
-      if (!memcmp(n->name, t->qd, t->qdlen)) {
-	/* Is the node expired? */
-	if (n->expire && (current_time > n->expire)) {
-	  cache_free_node(ReplyCache, hash, n);
-	  break;
-	}
-
-	/* Found in cache; move to head of usefulness list */
-	mrulist_del(ReplyCache, n);
-	mrulist_add(ReplyCache, n);
-	return;
-      }
-    }
+  /* Already cached? */
+  if (_cache_lookup(ReplyCache, hash, 0, t->qtype, t->protocol, t->qd, t->qdlen)) {
+    SHARD_UNLOCK(ReplyCache, shard);
+    return;
   }
 
   /* If the cache is full, delete the least recently used node and add new node */
-  if (ReplyCache->count >= ReplyCache->limit) {
-    if (ReplyCache->mruTail) {
-      ReplyCache->removed++;
-      ReplyCache->removed_secs += current_time - ReplyCache->mruTail->insert_time;
-      cache_free_node(ReplyCache, ReplyCache->mruTail->hash, ReplyCache->mruTail);
-    } else
-      return;
+  if (ReplyCache->count >= ReplyCache->limit && !cache_evict(ReplyCache, shard)) {
+    SHARD_UNLOCK(ReplyCache, shard);
+    return;
   }
 
+  /* The data is the DNS_HEADER, the reason, then the reply */
+  datalen = sizeof(DNS_HEADER) + sizeof(task_error_t) + t->replylen;
+
   /* Add to cache */
-  ReplyCache->in++;
+  if (!(n = cache_new_node(ReplyCache, hash, t->qd, t->qdlen, datalen))) {
+    SHARD_UNLOCK(ReplyCache, shard);
+    return;
+  }
 
-  n = ALLOCATE(sizeof(CNODE), CNODE);
-  n->hash = hash;
   n->zone = t->zone;
   n->type = t->qtype;
   n->protocol = t->protocol;
-  memcpy(n->name, t->qd, t->qdlen);
-  n->namelen = t->qdlen;
 
-  /* The data is the DNS_HEADER, the reason, then the reply */
-  n->datalen = sizeof(DNS_HEADER) + sizeof(task_error_t) + t->replylen;
-  n->data = ALLOCATE(n->datalen, char[]);
+  n->datalen = datalen;
   p = n->data;
 
   /* Save DNS header */
@@ -819,15 +1217,14 @@ add_reply_to_cache(TASK *t) {
   n->insert_time = current_time;
   if (ReplyCache->expire)
     n->expire = current_time + ReplyCache->expire;
-  n->next_node = ReplyCache->nodes[hash];
-
-  /* Add node to cache */
-  ReplyCache->nodes[hash] = n;
-  ReplyCache->count++;
 
-  /* Add node to head of MRU list */
-  mrulist_add(ReplyCache, n);
+  /* Add node to cache and to head of MRU list */
+  if (cache_add_node(ReplyCache, n) < 0)
+    RELEASE(n);
+  else
+    CACHE_COUNT(ReplyCache, in);
 
+  SHARD_UNLOCK(ReplyCache, shard);
 }
 /*--- add_reply_to_cache() ----------------------------------------------------------------------*/
 
@@ -21,22 +21,22 @@
 #ifndef _CACHE_H
 #define _CACHE_H
 
-/* The actual number of slots specified for `nodes' is the limit multiplied by this number.
-	A higher value will yield greater speed (due to fewer collisions) but will use more memory. */
-#define	CACHE_SLOT_MULTIPLIER	5
+/* The caches are open addressed tables with at least this many slots for each node allowed.
+	A higher value will yield greater speed (due to shorter probes) but will use more memory. */
+#define	CACHE_SLOT_MULTIPLIER	2
+
+/* Number of separately locked shards a shared cache is split into (power of two) */
+#define	CACHE_SHARDS				64
 
 /* Set this to 1 to enable the negative cache */
 #define	USE_NEGATIVE_CACHE	1
 
-/* Hash types */
-#define	ORIGINAL_HASH	0							/* Original hash */
-#define	ADDITIVE_HASH	1							/* Additive hash */
-#define	ROTATING_HASH	2							/* Rotating hash */
-#define	FNV_HASH			3							/* FNV hash (http://www.isthe.com/chongo/tech/comp/fnv/) */
-
-#ifndef	HASH_TYPE
-#define	HASH_TYPE	ADDITIVE_HASH				/* Default hash type */
-#endif
+/* Hash types (selected with the `cache-hash' option) */
+typedef enum _cache_hash_t {
+	CACHE_HASH_WYHASH = 0,							/* 64-bit multiply/xor mix, in the style of wyhash */
+	CACHE_HASH_CRC32C = 1,							/* Hardware CRC32C (SSE 4.2) */
+	CACHE_HASH_FNV = 2,								/* FNV hash (http://www.isthe.com/chongo/tech/comp/fnv/) */
+} cache_hash_t;
 
 #define	FNV_32_INIT		((uint32_t)2166136261U)
 #define	FNV_32_PRIME	((uint32_t)0x01000193)
@@ -50,7 +50,7 @@ typedef struct _cnode								/* A cache node */
 	dns_qtype_t		type;						/* Record type */
 	int			protocol;					/* Protocol used (SOCK_DGRAM/SOCK_STREAM) */
 
-	char			name[DNS_MAXNAMELEN + 1];			/* The name to look up */
+	char			*name;						/* The name to look up (stored after the node) */
 	size_t			namelen;					/* strlen(name) */
 
 	void			*data;						/* SOA or RR record or reply data (depending on `type') */
@@ -59,11 +59,20 @@ typedef struct _cnode								/* A cache node */
 	time_t			insert_time;					/* Time record was inserted */
 	time_t			expire;						/* Time after which this node should expire */
 
-	struct _cnode *next_node;						/* Pointer to next node in bucket */
+	uint32_t		refs;						/* Tasks using `data' (zone cache) */
+	int			dead;						/* Removed from the cache, free when `refs' drops to 0 */
+
 	struct _cnode *mruPrev, *mruNext;					/* Pointer to next/prev node in MRU/LRU list */
 } CNODE;
 
 
+typedef struct _cslot								/* A slot in a cache table */
+{
+	uint32_t		hash;						/* Hash of `node', compared before the node is looked at */
+	CNODE			*node;						/* The node, NULL if the slot is empty */
+} CSLOT;
+
+
 typedef struct _cache								/* A cache */
 {
 	char			name[20];							/* Name of this cache */
@@ -83,17 +92,18 @@ typedef struct _cache								/* A cache */
 
 	time_t		removed_secs;						/* Total lifetime seconds of removed entries */
 
-	uint32_t		slots;								/* Number of slots in `nodes' array */
-#if (HASH_TYPE == ROTATING_HASH)
-	uint32_t		mask;									/* Hash mask */
-#endif                                       
-#if (HASH_TYPE == FNV_HASH)
-	uint32_t		bits;									/* Bit length of hash table */
-#endif
+	uint32_t		shards;								/* Number of shards (power of two) */
+	uint32_t		shard_bits;							/* log2(shards) */
+	uint32_t		slots;								/* Number of slots in each shard (power of two) */
+	uint32_t		*used;								/* Number of nodes in each shard */
+
+	CSLOT			*table;								/* Slots of all the shards, one after the other */
 
-	CNODE			**nodes;								/* Array of nodes */
-                                             
 	CNODE			*mruHead, *mruTail;				/* Most/Least recently used (MRU/LRU) nodes (head/tail) */
+
+	int			shared;								/* In shared memory, seen by every server */
+	mydns_lock_t	lock;									/* Guards the MRU list and counts (shared) */
+	mydns_lock_t	*locks;								/* Guards each shard of `table' (shared) */
 } CACHE;
 
 
@@ -105,11 +115,13 @@ extern CACHE *NegativeCache;						/* Negative zone cache */
 #endif
 
 extern void cache_status(CACHE *);
-extern void cache_init(void), cache_empty(CACHE *), cache_cleanup(CACHE *);
+extern void cache_init(int, int), cache_empty(CACHE *), cache_cleanup(CACHE *);
 extern void cache_purge_zone(CACHE *, uint32_t);
 extern void *zone_cache_find(TASK *, uint32_t, char *, dns_qtype_t, const char *, size_t, int *, MYDNS_SOA *);
+extern void zone_cache_release(TASK *);
 
 extern int  reply_cache_find(TASK *);
+extern size_t reply_cache_peek(dns_qtype_t, int, unsigned char *, size_t, char *, size_t, DNS_HEADER *);
 extern void add_reply_to_cache(TASK *);
 
 
@@ -128,6 +128,8 @@ find_soa2(
 /**************************************************************************************************
 	FIND_RR
 	Look up RR.  Returns NULL if not found.
+	Like find_soa(), the records returned belong to the task until it is freed (see
+	zone_cache_release()); they are shared with the zone cache and must not be changed.
 **************************************************************************************************/
 MYDNS_RR *
 find_rr(
@@ -142,8 +144,6 @@ find_rr(
   rr = zone_cache_find(t, soa->id, soa->origin, type, name, strlen(name), &errflag, soa);
 
   if (errflag) {
-    if (rr)
-      mydns_rr_free(rr);
     dnserror(t, DNS_RCODE_SERVFAIL, ERR_DB_ERROR);
     return (NULL);
   }
@@ -155,7 +155,6 @@ find_rr(
     for (r = rr; r; r = r->next) {
       if (MYDNS_RR_DATA_LENGTH(r) && ((char*)MYDNS_RR_DATA_VALUE(r))[0]) continue;
 
-      mydns_rr_free(rr);
       dnserror(t, DNS_RCODE_SERVFAIL, ERR_NAME_FORMAT);
       return (NULL);
     }
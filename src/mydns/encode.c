@@ -27,27 +27,122 @@
 #define	NO_ENCODING	0
 
 
+/*
+ * Names remembered for compression live in a small per-task side arena rather than in fixed
+ * arrays inside the TASK.  Both the arena and the index are grown on demand and are kept
+ * when a task is recycled, so a typical query allocates nothing here at all.
+ *
+ * Lookups go through a hash index keyed on the case folded name, candidates are then checked
+ * against the remembered text.  Each bucket is tagged with the generation it was filled in,
+ * so forgetting every name between messages only has to bump the generation.
+ */
+#define NAME_MINENTRIES		16			/* Entries allocated on first use */
+#define NAME_MINARENA		512			/* Octets of name text allocated on first use */
+#define NAME_MINBUCKETS		32			/* Hash buckets allocated on first use */
+
+#define NAME_FOLD(c)		(((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : (c))
+
+
+/**************************************************************************************************
+	NAME_HASH
+	Case folded FNV-1a hash of a name.  Sets `len' to the length of the name.
+**************************************************************************************************/
+static inline uint32_t
+name_hash(const char *name, size_t *len) {
+  register const unsigned char	*c = (const unsigned char *)name;
+  register uint32_t		hash = 2166136261U;
+
+  for (; *c; c++) {
+    hash ^= NAME_FOLD(*c);
+    hash *= 16777619U;
+  }
+  *len = c - (const unsigned char *)name;
+  return (hash);
+}
+/*--- name_hash() -------------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	NAME_BUCKET
+	Returns the bucket for `hash', emptying it first if it was filled in an earlier generation.
+**************************************************************************************************/
+static inline TASKNAMEBUCKET *
+name_bucket(TASK *t, uint32_t hash) {
+  register TASKNAMEBUCKET	*b = &t->NameBuckets[hash & (t->numNameBuckets - 1)];
+
+  if (b->gen != t->NameGen) {
+    b->gen = t->NameGen;
+    b->head = 0;
+  }
+  return (b);
+}
+/*--- name_bucket() -----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	NAME_REHASH
+	Grow the hash index to `size' buckets and refile the names already remembered.
+**************************************************************************************************/
+static void
+name_rehash(TASK *t, unsigned int size) {
+  register TASKNAMEBUCKET	*b = NULL;
+  register unsigned int		n = 0;
+
+  RELEASE(t->NameBuckets);
+  t->NameBuckets = ALLOCATE(size * sizeof(TASKNAMEBUCKET), TASKNAMEBUCKET[]);
+  t->numNameBuckets = size;
+  if (!t->NameGen)
+    t->NameGen = 1;
+
+  for (n = 0; n < t->numNames; n++) {
+    b = name_bucket(t, t->Names[n].hash);
+    t->Names[n].next = b->head;
+    b->head = n + 1;
+  }
+}
+/*--- name_rehash() -----------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	NAME_REMEMBER
 	Adds the specified name + offset to the `Labels' array within the specified task.
 **************************************************************************************************/
 int
 name_remember(TASK *t, const char *name, unsigned int offset) {
-  if (!name || strlen(name) > 64)			/* Don't store labels > 64 bytes in length */
+  register TASKNAMEBUCKET	*b = NULL;
+  register TASKNAME		*n = NULL;
+  size_t			len = 0;
+  uint32_t			hash = 0;
+
+  if (!name || offset > 0x3FFF)				/* Beyond reach of a compression pointer */
     return (0);
 
-#if DYNAMIC_NAMES
-  t->Names = REALLOCATE(t->Names, (t->numNames + 1) * sizeof(char *), char*[]);
-  t->Names[t->numNames] = STRDUP(name);
-  t->Offsets = REALLOCATE(t->Offsets, (t->numNames + 1) * sizeof(unsigned int), unsigned int[]);
-#else
-  if (t->numNames >= MAX_STORED_NAMES - 1)
-    return dnserror(t, DNS_RCODE_SERVFAIL, ERR_RR_NAME_TOO_LONG);
-  strncpy(t->Names[t->numNames], name, sizeof(t->Names[t->numNames]) - 1);
-#endif
+  hash = name_hash(name, &len);
 
-  t->Offsets[t->numNames] = offset;
-  t->numNames++;
+  if (t->numNames >= t->maxNames) {
+    t->maxNames = t->maxNames ? t->maxNames * 2 : NAME_MINENTRIES;
+    t->Names = REALLOCATE(t->Names, t->maxNames * sizeof(TASKNAME), TASKNAME[]);
+  }
+  if (t->NameArenaLen + len + 1 > t->NameArenaSize) {
+    while (t->NameArenaLen + len + 1 > t->NameArenaSize)
+      t->NameArenaSize = t->NameArenaSize ? t->NameArenaSize * 2 : NAME_MINARENA;
+    t->NameArena = REALLOCATE(t->NameArena, t->NameArenaSize, char[]);
+  }
+  if (t->numNames >= t->numNameBuckets)
+    name_rehash(t, t->numNameBuckets ? t->numNameBuckets * 2 : NAME_MINBUCKETS);
+
+  memcpy(&t->NameArena[t->NameArenaLen], name, len + 1);
+
+  n = &t->Names[t->numNames];
+  n->name = t->NameArenaLen;
+  n->offset = offset;
+  n->hash = hash;
+
+  b = name_bucket(t, hash);
+  n->next = b->head;
+  b->head = ++t->numNames;
+
+  t->NameArenaLen += len + 1;
   return (0);
 }
 /*--- name_remember() ---------------------------------------------------------------------------*/
@@ -55,23 +150,38 @@ name_remember(TASK *t, const char *name, unsigned int offset) {
 
 /**************************************************************************************************
 	NAME_FORGET
-	Forget all names in the specified task.
+	Forget all names in the specified task.  The buffers are kept for reuse.
 **************************************************************************************************/
 inline void
 name_forget(TASK *t) {
-#if DYNAMIC_NAMES
-  register int n = 0;
-
-  for (n = 0; n < t->numNames; n++)
-    RELEASE(t->Names[n]);
-  RELEASE(t->Names);
-  RELEASE(t->Offsets);
-#endif
   t->numNames = 0;
+  t->NameArenaLen = 0;
+
+  /* Start a new generation, on the (unlikely) wrap really empty the buckets */
+  if (!++t->NameGen) {
+    if (t->NameBuckets)
+      memset(t->NameBuckets, 0, t->numNameBuckets * sizeof(TASKNAMEBUCKET));
+    t->NameGen = 1;
+  }
 }
 /*--- name_forget() -----------------------------------------------------------------------------*/
 
 
+/**************************************************************************************************
+	NAME_FREE
+	Release the name buffers of a task.
+**************************************************************************************************/
+void
+name_free(TASK *t) {
+  RELEASE(t->Names);
+  RELEASE(t->NameArena);
+  RELEASE(t->NameBuckets);
+  t->numNames = t->maxNames = t->numNameBuckets = 0;
+  t->NameArenaLen = t->NameArenaSize = 0;
+}
+/*--- name_free() -------------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	NAME_FIND
 	Searches the task's remembered names arary for `name'.
@@ -79,12 +189,21 @@ name_forget(TASK *t) {
 **************************************************************************************************/
 unsigned int
 name_find(TASK *t, const char *name) {
-  register unsigned int n = 0;
+  register TASKNAME		*n = NULL;
+  register unsigned int		next = 0;
+  size_t			len = 0;
+  uint32_t			hash = 0;
 
-  for (n = 0; n < t->numNames; n++)
-    if (!strcasecmp(t->Names[n], name)) {
-      return (t->Offsets[n]);
-    }
+  if (!t->numNames)
+    return (0);
+
+  hash = name_hash(name, &len);
+
+  for (next = name_bucket(t, hash)->head; next; next = n->next) {
+    n = &t->Names[next - 1];
+    if (n->hash == hash && !strcasecmp(&t->NameArena[n->name], name))
+      return (n->offset);
+  }
   return (0);
 }
 /*--- name_find() -------------------------------------------------------------------------------*/
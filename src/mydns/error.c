@@ -27,7 +27,7 @@
 /* The maximum number of resource record ID errors that we'll remember (and avoid repeating) */
 #define	MAX_RR_ERR_MEMORY	1024
 
-uint32_t	rr_err_memory[MAX_RR_ERR_MEMORY];
+THREADLOCAL uint32_t	rr_err_memory[MAX_RR_ERR_MEMORY];
 
 
 /**************************************************************************************************
@@ -36,7 +36,7 @@ uint32_t	rr_err_memory[MAX_RR_ERR_MEMORY];
 **************************************************************************************************/
 char *
 err_reason_str(TASK *t, task_error_t reason) {
-  static char *buf = NULL;
+  static THREADLOCAL char *buf = NULL;
 
   switch (reason) {
   case ERR_NONE:			return ((char *)"-");
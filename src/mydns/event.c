@@ -0,0 +1,848 @@
+/**************************************************************************************************
+	$Id: event.c,v 1.0 2009/01/20 10:00:00 howard Exp $
+
+	Copyright (C) 2009  Howard Wilkinson <howard@cohtech.com>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at Your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+**************************************************************************************************/
+
+#include "named.h"
+
+/* Make this nonzero to enable debugging for this source file */
+#define	DEBUG_EVENT	1
+
+#if HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE
+#	include <sys/epoll.h>
+#	define USE_EPOLL 1
+#endif
+
+#if HAVE_SYS_EVENT_H && HAVE_KQUEUE
+#	include <sys/event.h>
+#	define USE_KQUEUE 1
+#endif
+
+#if HAVE_LINUX_IO_URING_H && HAVE_SYS_MMAN_H
+#	include <linux/io_uring.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_EXT_ARG)
+#		define USE_IO_URING 1
+#	endif
+#endif
+
+/*
+ * Persistent event backend for the task loop.
+ *
+ * Tasks are registered once, when they are created, against the fd they wait on.
+ * Every task is in one of three states:
+ *
+ *	EVENT_IDLE	- not known to the backend (not in TaskArray, e.g. parked on a connect queue)
+ *	EVENT_WAITING	- on the wait list of its fd, waiting for POLLIN and/or POLLOUT
+ *	EVENT_RUNNABLE	- on the runnable list, it has no IO to wait for (Needs2Exec etc.)
+ *
+ * The interest given to the kernel for an fd is the union of what the tasks on its
+ * wait list want, and is only changed when that union changes.  Tasks that the kernel
+ * reports as ready, and all runnable tasks, are put on per priority ready lists and
+ * the main loop only dispatches those.
+ */
+#define EVENT_IDLE		0
+#define EVENT_WAITING		1
+#define EVENT_RUNNABLE		2
+
+#define EVENT_BATCH		256		/* Maximum events collected by one wait */
+
+/*
+ * The io_uring backend keeps the same model: each fd with interest has one poll request in
+ * the ring.  Requests are one-shot and re-armed as their completion is reaped, so a socket
+ * that still has data is reported again on the next wait, as it would be by epoll.
+ * Arming, re-arming and removing only fill in submission entries; they reach the kernel
+ * together with the wait, in a single io_uring_enter() per pass of the loop.
+ * Each arming of an fd gets a new generation so completions of older requests, that were
+ * removed or raced with a close, are recognised and dropped.
+ */
+#define EVENT_URING_ENTRIES	1024		/* Submission queue size */
+#define EVENT_URING_IGNORE	(~(uint64_t)0)	/* user_data of requests whose completion is dropped */
+#define EVENT_URING_DATA(fd, gen) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+
+typedef enum _event_backend_t {
+  EVENT_BACKEND_NONE = 0,			/* Rebuild poll/select set every loop (main.c) */
+  EVENT_BACKEND_EPOLL = 1,
+  EVENT_BACKEND_KQUEUE = 2,
+  EVENT_BACKEND_IO_URING = 3,
+} event_backend_t;
+
+typedef struct _event_fd {
+  TASK		*head;				/* Tasks waiting for IO on this fd */
+  int		mask;				/* Interest (POLLIN|POLLOUT) registered with the kernel */
+  uint32_t	gen;				/* io_uring: generation of the last poll request */
+  int		armed;				/* io_uring: poll request outstanding? */
+} EVENTFD;
+
+#if USE_IO_URING
+typedef struct _event_uring {
+  unsigned		*sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned		*cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe	*sqes;
+  struct io_uring_cqe	*cqes;
+  void			*sq_ring, *cq_ring;
+  size_t		sq_ring_size, cq_ring_size, sqes_size;
+  unsigned		sq_entries;
+  unsigned		sq_local_tail;		/* Entries filled in, not all submitted yet */
+} EVENTURING;
+
+static THREADLOCAL EVENTURING	event_ring;
+#endif
+
+static THREADLOCAL event_backend_t	event_backend = EVENT_BACKEND_NONE;
+static THREADLOCAL int		event_kfd = -1;		/* epoll/kqueue descriptor */
+
+static THREADLOCAL EVENTFD		*event_fds = NULL;	/* Indexed by fd */
+static THREADLOCAL int		event_numfds = 0;
+
+static THREADLOCAL TASK		*runnable_head = NULL;	/* Tasks with nothing to wait for */
+static THREADLOCAL TASK		*runnable_tail = NULL;
+
+static THREADLOCAL TASK		*ready_head[LOW_PRIORITY_TASK+1];
+static THREADLOCAL TASK		*ready_tail[LOW_PRIORITY_TASK+1];
+
+
+/**************************************************************************************************
+	EVENT_BACKEND_NAME
+**************************************************************************************************/
+const char *
+event_backend_name(void) {
+  switch (event_backend) {
+  case EVENT_BACKEND_EPOLL:	return "epoll";
+  case EVENT_BACKEND_KQUEUE:	return "kqueue";
+  case EVENT_BACKEND_IO_URING:	return "io_uring";
+  default:
+#if HAVE_POLL
+    return "poll";
+#else
+    return "select";
+#endif
+  }
+}
+/*--- event_backend_name() ----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	EVENT_ACTIVE
+	Returns nonzero if a persistent event backend is in use.
+**************************************************************************************************/
+int
+event_active(void) {
+  return (event_backend != EVENT_BACKEND_NONE);
+}
+/*--- event_active() ----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_EVENT_READY_PUSH / _EVENT_READY_REMOVE
+	Maintain the per priority lists of tasks waiting to be dispatched.
+**************************************************************************************************/
+static void
+_event_ready_push(TASK *t, int revents) {
+  taskpriority_t p = t->priority;
+
+  t->event_revents |= revents;
+
+  if (t->event_ready) return;
+
+  /* Remember which list we went on in case the priority changes before dispatch */
+  t->event_ready = p + 1;
+  t->ready_next = NULL;
+  t->ready_prev = ready_tail[p];
+  if (ready_tail[p])
+    ready_tail[p]->ready_next = t;
+  else
+    ready_head[p] = t;
+  ready_tail[p] = t;
+}
+
+static void
+_event_ready_remove(TASK *t) {
+  int p = t->event_ready - 1;
+
+  if (!t->event_ready) return;
+
+  if (t->ready_prev) t->ready_prev->ready_next = t->ready_next;
+  else ready_head[p] = t->ready_next;
+  if (t->ready_next) t->ready_next->ready_prev = t->ready_prev;
+  else ready_tail[p] = t->ready_prev;
+
+  t->ready_prev = t->ready_next = NULL;
+  t->event_ready = 0;
+  t->event_revents = 0;
+}
+
+
+#if USE_IO_URING
+/**************************************************************************************************
+	_EVENT_URING_ENTER
+	Submit what is queued and optionally wait for completions.
+	Returns the number submitted or -1 with errno set.
+**************************************************************************************************/
+static int
+_event_uring_enter(unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+  unsigned	to_submit = 0;
+
+  __sync_synchronize();
+  to_submit = event_ring.sq_local_tail - *event_ring.sq_head;
+
+  return (int)syscall(__NR_io_uring_enter, event_kfd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+/**************************************************************************************************
+	_EVENT_URING_SQE
+	Get the next free submission entry, submitting early if the queue is full.
+**************************************************************************************************/
+static struct io_uring_sqe *
+_event_uring_sqe(void) {
+  struct io_uring_sqe	*sqe = NULL;
+  unsigned		idx = 0;
+
+  __sync_synchronize();
+  while (event_ring.sq_local_tail - *event_ring.sq_head >= event_ring.sq_entries) {
+    if (_event_uring_enter(0, 0, NULL, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      Err(_("io_uring_enter"));
+    __sync_synchronize();
+  }
+
+  idx = event_ring.sq_local_tail & *event_ring.sq_mask;
+  sqe = &event_ring.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  event_ring.sq_array[idx] = idx;
+  return (sqe);
+}
+
+
+/**************************************************************************************************
+	_EVENT_URING_PUSH
+	Make the entry filled in by the caller visible to the kernel (on the next enter).
+**************************************************************************************************/
+static void
+_event_uring_push(void) {
+  event_ring.sq_local_tail++;
+  __sync_synchronize();
+  *event_ring.sq_tail = event_ring.sq_local_tail;
+}
+
+
+/**************************************************************************************************
+	_EVENT_URING_ARM
+	Replace the poll request for an fd with one for 'mask' (none if 'mask' is 0).
+**************************************************************************************************/
+static void
+_event_uring_arm(int fd, int mask) {
+  EVENTFD		*e = &event_fds[fd];
+  struct io_uring_sqe	*sqe = NULL;
+
+  if (e->armed) {
+    sqe = _event_uring_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = EVENT_URING_DATA(fd, e->gen);
+    sqe->user_data = EVENT_URING_IGNORE;
+    _event_uring_push();
+    e->armed = 0;
+  }
+
+  if (!mask) return;
+
+  e->gen++;
+  sqe = _event_uring_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = mask;
+  sqe->user_data = EVENT_URING_DATA(fd, e->gen);
+  _event_uring_push();
+  e->armed = 1;
+}
+#endif
+
+
+/**************************************************************************************************
+	_EVENT_KERNEL_APPLY
+	Tell the kernel about a change of interest on an fd.
+**************************************************************************************************/
+static void
+_event_kernel_apply(int fd, int oldmask, int newmask) {
+#if USE_IO_URING
+  if (event_backend == EVENT_BACKEND_IO_URING) {
+    _event_uring_arm(fd, newmask);
+    return;
+  }
+#endif
+#if USE_EPOLL
+  if (event_backend == EVENT_BACKEND_EPOLL) {
+    struct epoll_event	ev;
+    int			op = (!oldmask) ? EPOLL_CTL_ADD : (!newmask) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    int			rv;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (newmask & POLLIN) ev.events |= EPOLLIN;
+    if (newmask & POLLOUT) ev.events |= EPOLLOUT;
+
+    rv = epoll_ctl(event_kfd, op, fd, &ev);
+    /* The fd may have been closed and reopened under us - converge on the state we want */
+    if (rv < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+      rv = epoll_ctl(event_kfd, EPOLL_CTL_MOD, fd, &ev);
+    else if (rv < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+      rv = epoll_ctl(event_kfd, EPOLL_CTL_ADD, fd, &ev);
+    if (rv < 0 && !(op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF)))
+      Warn(_("epoll_ctl failed for fd %d"), fd);
+    return;
+  }
+#endif
+#if USE_KQUEUE
+  if (event_backend == EVENT_BACKEND_KQUEUE) {
+    struct kevent	changes[2];
+    int			n = 0;
+
+    if ((newmask & POLLIN) && !(oldmask & POLLIN)) {
+      EV_SET(&changes[n], fd, EVFILT_READ, EV_ADD, 0, 0, NULL); n++;
+    } else if (!(newmask & POLLIN) && (oldmask & POLLIN)) {
+      EV_SET(&changes[n], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL); n++;
+    }
+    if ((newmask & POLLOUT) && !(oldmask & POLLOUT)) {
+      EV_SET(&changes[n], fd, EVFILT_WRITE, EV_ADD, 0, 0, NULL); n++;
+    } else if (!(newmask & POLLOUT) && (oldmask & POLLOUT)) {
+      EV_SET(&changes[n], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL); n++;
+    }
+    if (n && kevent(event_kfd, changes, n, NULL, 0, NULL) < 0
+	&& errno != ENOENT && errno != EBADF)
+      Warn(_("kevent failed for fd %d"), fd);
+    return;
+  }
+#endif
+}
+
+
+/**************************************************************************************************
+	_EVENT_FD_APPLY
+	Recompute the interest for an fd from the tasks waiting on it.
+**************************************************************************************************/
+static void
+_event_fd_apply(int fd) {
+  EVENTFD	*e = &event_fds[fd];
+  TASK		*t = NULL;
+  int		mask = 0;
+
+  for (t = e->head; t; t = t->event_next)
+    mask |= t->event_mask;
+
+  if (mask == e->mask) return;
+
+#if DEBUG_ENABLED && DEBUG_EVENT
+  DebugX("event", 1, _("fd %d interest changes from %x to %x"), fd, e->mask, mask);
+#endif
+
+  _event_kernel_apply(fd, e->mask, mask);
+  e->mask = mask;
+}
+
+
+/**************************************************************************************************
+	_EVENT_DETACH
+	Take a task off the wait or runnable list it is on.
+**************************************************************************************************/
+static void
+_event_detach(TASK *t) {
+  if (t->event_state == EVENT_WAITING) {
+    EVENTFD *e = &event_fds[t->event_fd];
+    if (t->event_prev) t->event_prev->event_next = t->event_next;
+    else e->head = t->event_next;
+    if (t->event_next) t->event_next->event_prev = t->event_prev;
+  } else if (t->event_state == EVENT_RUNNABLE) {
+    if (t->event_prev) t->event_prev->event_next = t->event_next;
+    else runnable_head = t->event_next;
+    if (t->event_next) t->event_next->event_prev = t->event_prev;
+    else runnable_tail = t->event_prev;
+  }
+  t->event_prev = t->event_next = NULL;
+  t->event_state = EVENT_IDLE;
+}
+
+
+/**************************************************************************************************
+	_EVENT_GROW
+	Make sure the fd table can index 'fd'.
+**************************************************************************************************/
+static void
+_event_grow(int fd) {
+  int newsize = event_numfds;
+
+  if (fd < event_numfds) return;
+
+  if (newsize < 64) newsize = 64;
+  while (newsize <= fd) newsize *= 2;
+
+  event_fds = (EVENTFD*)REALLOCATE(event_fds, newsize * sizeof(EVENTFD), EVENTFD[]);
+  memset(&event_fds[event_numfds], 0, (newsize - event_numfds) * sizeof(EVENTFD));
+  event_numfds = newsize;
+}
+
+
+/**************************************************************************************************
+	EVENT_TASK_UPDATE
+	Bring the registration of a task into line with its fd and status.
+	Called when a task is created, requeued or its status may have changed.
+**************************************************************************************************/
+void
+event_task_update(TASK *t) {
+  int		mask = 0;
+  int		oldfd = -1;
+
+  if (event_backend == EVENT_BACKEND_NONE || !t) return;
+
+  /* Tasks parked on a private queue are not scheduled */
+  if (!t->TaskQ || t->TaskQ != &TaskArray[t->type][t->priority]) {
+    oldfd = (t->event_state == EVENT_WAITING) ? t->event_fd : -1;
+    _event_ready_remove(t);
+    _event_detach(t);
+    if (oldfd >= 0) _event_fd_apply(oldfd);
+    t->event_fd = -1;
+    return;
+  }
+
+  if (t->fd >= 0) {
+    if (t->status & Needs2Read) mask |= POLLIN;
+    if (t->status & Needs2Write) mask |= POLLOUT;
+  }
+
+  if (mask) {
+    if (t->event_state == EVENT_WAITING && t->event_fd == t->fd) {
+      if (t->event_mask != mask) {
+	t->event_mask = mask;
+	_event_fd_apply(t->fd);
+      }
+      return;
+    }
+    oldfd = (t->event_state == EVENT_WAITING) ? t->event_fd : -1;
+    _event_detach(t);
+    if (oldfd >= 0) _event_fd_apply(oldfd);
+
+    _event_grow(t->fd);
+    t->event_fd = t->fd;
+    t->event_mask = mask;
+    t->event_state = EVENT_WAITING;
+    t->event_prev = NULL;
+    t->event_next = event_fds[t->fd].head;
+    if (t->event_next) t->event_next->event_prev = t;
+    event_fds[t->fd].head = t;
+    _event_fd_apply(t->fd);
+    return;
+  }
+
+  if (t->event_state == EVENT_RUNNABLE) return;
+
+  oldfd = (t->event_state == EVENT_WAITING) ? t->event_fd : -1;
+  _event_detach(t);
+  if (oldfd >= 0) _event_fd_apply(oldfd);
+
+  t->event_fd = -1;
+  t->event_mask = 0;
+  t->event_state = EVENT_RUNNABLE;
+  t->event_next = NULL;
+  t->event_prev = runnable_tail;
+  if (runnable_tail) runnable_tail->event_next = t;
+  else runnable_head = t;
+  runnable_tail = t;
+
+  /* Newly runnable tasks get dispatched on this pass */
+  _event_ready_push(t, 0);
+}
+/*--- event_task_update() -----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	EVENT_TASK_REMOVE
+	Forget a task - called as the task is freed.
+**************************************************************************************************/
+void
+event_task_remove(TASK *t) {
+  int oldfd = (t->event_state == EVENT_WAITING) ? t->event_fd : -1;
+
+  _event_ready_remove(t);
+  _event_detach(t);
+  if (oldfd >= 0 && event_backend != EVENT_BACKEND_NONE) _event_fd_apply(oldfd);
+  t->event_fd = -1;
+}
+/*--- event_task_remove() -----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	EVENT_PENDING
+	Returns nonzero if there is work that should be done without waiting for IO.
+**************************************************************************************************/
+int
+event_pending(void) {
+  TASK *t = NULL;
+
+  for (t = runnable_head; t; t = t->event_next)
+    if ((t->status & Needs2Exec) && (t->type != PERIODIC_TASK))
+      return 1;
+
+  return 0;
+}
+/*--- event_pending() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_EVENT_FD_READY
+	The kernel reported events on an fd - make the tasks that wanted them ready.
+**************************************************************************************************/
+static void
+_event_fd_ready(int fd, int revents) {
+  TASK *t = NULL;
+
+  if (fd < 0 || fd >= event_numfds) return;
+
+  for (t = event_fds[fd].head; t; t = t->event_next) {
+    if ((revents & (POLLERR|POLLHUP|POLLNVAL)) || (revents & t->event_mask))
+      _event_ready_push(t, revents);
+  }
+}
+
+
+/**************************************************************************************************
+	EVENT_WAIT
+	Wait up to 'timeout' milliseconds (-1 for ever) for IO and build the ready lists.
+	Returns the number of fds with events or -1 with errno set.
+**************************************************************************************************/
+int
+event_wait(int timeout) {
+  TASK	*t = NULL;
+  int	n = 0, i = 0;
+
+  /* Tasks with nothing to wait for run on every pass */
+  for (t = runnable_head; t; t = t->event_next)
+    _event_ready_push(t, 0);
+
+#if USE_EPOLL
+  if (event_backend == EVENT_BACKEND_EPOLL) {
+    struct epoll_event events[EVENT_BATCH];
+
+    if ((n = epoll_wait(event_kfd, events, EVENT_BATCH, timeout)) < 0)
+      return n;
+
+    for (i = 0; i < n; i++) {
+      int revents = 0;
+      if (events[i].events & EPOLLIN) revents |= POLLIN;
+      if (events[i].events & EPOLLOUT) revents |= POLLOUT;
+      if (events[i].events & EPOLLERR) revents |= POLLERR;
+      if (events[i].events & EPOLLHUP) revents |= POLLHUP;
+      _event_fd_ready(events[i].data.fd, revents);
+    }
+  }
+#endif
+#if USE_KQUEUE
+  if (event_backend == EVENT_BACKEND_KQUEUE) {
+    struct kevent	events[EVENT_BATCH];
+    struct timespec	ts;
+
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+
+    if ((n = kevent(event_kfd, NULL, 0, events, EVENT_BATCH, (timeout < 0) ? NULL : &ts)) < 0)
+      return n;
+
+    for (i = 0; i < n; i++) {
+      int revents = 0;
+      if (events[i].flags & EV_ERROR) revents |= POLLERR;
+      else if (events[i].filter == EVFILT_READ) revents |= POLLIN;
+      else if (events[i].filter == EVFILT_WRITE) revents |= POLLOUT;
+      if ((events[i].flags & EV_EOF) && events[i].filter == EVFILT_READ && !events[i].data)
+	revents |= POLLHUP;
+      _event_fd_ready((int)events[i].ident, revents);
+    }
+  }
+#endif
+
+#if USE_IO_URING
+  if (event_backend == EVENT_BACKEND_IO_URING) {
+    struct io_uring_getevents_arg	arg;
+    struct __kernel_timespec		ts;
+    unsigned				head = 0, tail = 0;
+
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    if (timeout >= 0)
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    /* Hand over the queued poll requests and wait, all in one call */
+    if (_event_uring_enter(timeout ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			   &arg, sizeof(arg)) < 0
+	&& errno != ETIME && errno != EBUSY)
+      return -1;
+
+    head = *event_ring.cq_head;
+    __sync_synchronize();
+    tail = *event_ring.cq_tail;
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe	*cqe = &event_ring.cqes[head & *event_ring.cq_mask];
+      int			fd = (int)(uint32_t)cqe->user_data;
+      int			revents = 0;
+      EVENTFD			*e = NULL;
+
+      if (cqe->user_data == EVENT_URING_IGNORE || fd < 0 || fd >= event_numfds)
+	continue;
+      e = &event_fds[fd];
+      if (!e->armed || e->gen != (uint32_t)(cqe->user_data >> 32))
+	continue;					/* Request was replaced or removed */
+
+      e->armed = 0;
+      if (cqe->res == -ECANCELED)
+	continue;
+      revents = (cqe->res < 0) ? POLLERR : cqe->res;
+
+      /* One-shot - ask again for whatever the tasks on the fd want by the next wait */
+      if (e->mask)
+	_event_uring_arm(fd, e->mask);
+
+      _event_fd_ready(fd, revents);
+      n++;
+    }
+
+    __sync_synchronize();
+    *event_ring.cq_head = head;
+  }
+#endif
+
+#if DEBUG_ENABLED && DEBUG_EVENT
+  DebugX("event", 1, _("%s wait returned %d events"), event_backend_name(), n);
+#endif
+
+  return n;
+}
+/*--- event_wait() ------------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	EVENT_NEXT_READY
+	Pop the next task to dispatch, highest priority first.
+**************************************************************************************************/
+TASK *
+event_next_ready(int *rfd, int *wfd, int *efd) {
+  int	p = 0;
+  TASK	*t = NULL;
+
+  for (p = HIGH_PRIORITY_TASK; p <= LOW_PRIORITY_TASK; p++) {
+    while ((t = ready_head[p])) {
+      int revents = t->event_revents;
+
+      _event_ready_remove(t);
+
+      *rfd = revents & POLLIN;
+      *wfd = revents & POLLOUT;
+      *efd = revents & (POLLERR|POLLNVAL|POLLHUP);
+
+      /* Status may have moved on since the event arrived */
+      if (t->event_state == EVENT_WAITING && !*efd && !(revents & t->event_mask))
+	continue;
+
+      return t;
+    }
+  }
+  return NULL;
+}
+/*--- event_next_ready() ------------------------------------------------------------------------*/
+
+
+#if USE_IO_URING
+/**************************************************************************************************
+	_EVENT_URING_INIT
+	Set up the ring and map its queues.  Returns the ring fd or -1.
+**************************************************************************************************/
+static int
+_event_uring_init(void) {
+  struct io_uring_params	p;
+  int				fd = -1;
+
+  memset(&p, 0, sizeof(p));
+  memset(&event_ring, 0, sizeof(event_ring));
+
+  if ((fd = (int)syscall(__NR_io_uring_setup, EVENT_URING_ENTRIES, &p)) < 0)
+    return -1;
+
+  /* Needed to give the wait a timeout without using up a submission */
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    close(fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  event_ring.sq_entries = p.sq_entries;
+  event_ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  event_ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  event_ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  event_ring.sq_ring = mmap(NULL, event_ring.sq_ring_size, PROT_READ|PROT_WRITE,
+			    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  event_ring.cq_ring = mmap(NULL, event_ring.cq_ring_size, PROT_READ|PROT_WRITE,
+			    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  event_ring.sqes = mmap(NULL, event_ring.sqes_size, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (event_ring.sq_ring == MAP_FAILED || event_ring.cq_ring == MAP_FAILED
+      || event_ring.sqes == MAP_FAILED) {
+    if (event_ring.sq_ring != MAP_FAILED) munmap(event_ring.sq_ring, event_ring.sq_ring_size);
+    if (event_ring.cq_ring != MAP_FAILED) munmap(event_ring.cq_ring, event_ring.cq_ring_size);
+    if (event_ring.sqes != MAP_FAILED) munmap(event_ring.sqes, event_ring.sqes_size);
+    memset(&event_ring, 0, sizeof(event_ring));
+    close(fd);
+    return -1;
+  }
+
+  event_ring.sq_head = (unsigned *)((char *)event_ring.sq_ring + p.sq_off.head);
+  event_ring.sq_tail = (unsigned *)((char *)event_ring.sq_ring + p.sq_off.tail);
+  event_ring.sq_mask = (unsigned *)((char *)event_ring.sq_ring + p.sq_off.ring_mask);
+  event_ring.sq_array = (unsigned *)((char *)event_ring.sq_ring + p.sq_off.array);
+  event_ring.cq_head = (unsigned *)((char *)event_ring.cq_ring + p.cq_off.head);
+  event_ring.cq_tail = (unsigned *)((char *)event_ring.cq_ring + p.cq_off.tail);
+  event_ring.cq_mask = (unsigned *)((char *)event_ring.cq_ring + p.cq_off.ring_mask);
+  event_ring.cqes = (struct io_uring_cqe *)((char *)event_ring.cq_ring + p.cq_off.cqes);
+  event_ring.sq_local_tail = *event_ring.sq_tail;
+
+  return fd;
+}
+
+
+/**************************************************************************************************
+	_EVENT_URING_FREE
+	Unmap the ring, the caller closes the fd.
+**************************************************************************************************/
+static void
+_event_uring_free(void) {
+  if (event_ring.sq_ring) munmap(event_ring.sq_ring, event_ring.sq_ring_size);
+  if (event_ring.cq_ring) munmap(event_ring.cq_ring, event_ring.cq_ring_size);
+  if (event_ring.sqes) munmap(event_ring.sqes, event_ring.sqes_size);
+  memset(&event_ring, 0, sizeof(event_ring));
+}
+#endif
+
+
+/**************************************************************************************************
+	EVENT_RESET
+	Drop the backend without touching the kernel registrations - used after fork so that
+	the child does not modify the event set it shares with its parent.
+**************************************************************************************************/
+void
+event_reset(void) {
+  int i = 0, j = 0;
+  TASK *t = NULL;
+
+#if USE_IO_URING
+  if (event_backend == EVENT_BACKEND_IO_URING)
+    _event_uring_free();
+#endif
+  if (event_kfd >= 0) close(event_kfd);
+  event_kfd = -1;
+  event_backend = EVENT_BACKEND_NONE;
+
+  for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++) {
+    for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j++) {
+      if (!TaskArray[i][j]) continue;
+      for (t = TaskArray[i][j]->head; t; t = t->next) {
+	t->event_state = EVENT_IDLE;
+	t->event_prev = t->event_next = NULL;
+	t->event_ready = 0;
+	t->event_revents = 0;
+	t->ready_prev = t->ready_next = NULL;
+	t->event_fd = -1;
+      }
+    }
+  }
+  if (event_numfds) memset(event_fds, 0, event_numfds * sizeof(EVENTFD));
+  runnable_head = runnable_tail = NULL;
+  memset(ready_head, 0, sizeof(ready_head));
+  memset(ready_tail, 0, sizeof(ready_tail));
+}
+/*--- event_reset() -----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	EVENT_INIT
+	Select and start the event backend, then register every task that already exists.
+	The "event-backend" option picks one of auto, epoll, kqueue, io_uring or poll.
+	io_uring is only used when asked for, auto picks epoll or kqueue.
+**************************************************************************************************/
+void
+event_init(void) {
+  const char	*wanted = conf_get(&Conf, "event-backend", NULL);
+  int		i = 0, j = 0;
+  TASK		*t = NULL;
+
+  event_reset();
+
+  if (!wanted || !wanted[0]) wanted = "auto";
+
+  if (!strcasecmp(wanted, "poll") || !strcasecmp(wanted, "select")) {
+    Verbose(_("using %s event backend"), event_backend_name());
+    return;
+  }
+
+#if USE_IO_URING
+  if (!strcasecmp(wanted, "io_uring") || !strcasecmp(wanted, "uring")) {
+    if ((event_kfd = _event_uring_init()) >= 0)
+      event_backend = EVENT_BACKEND_IO_URING;
+    else {
+      Warn(_("io_uring_setup failed"));
+      wanted = "auto";
+    }
+  }
+#endif
+#if USE_EPOLL
+  if (event_backend == EVENT_BACKEND_NONE
+      && (!strcasecmp(wanted, "auto") || !strcasecmp(wanted, "epoll"))) {
+    if ((event_kfd = epoll_create(EVENT_BATCH)) >= 0)
+      event_backend = EVENT_BACKEND_EPOLL;
+    else
+      Warn(_("epoll_create failed"));
+  }
+#endif
+#if USE_KQUEUE
+  if (event_backend == EVENT_BACKEND_NONE
+      && (!strcasecmp(wanted, "auto") || !strcasecmp(wanted, "kqueue"))) {
+    if ((event_kfd = kqueue()) >= 0)
+      event_backend = EVENT_BACKEND_KQUEUE;
+    else
+      Warn(_("kqueue failed"));
+  }
+#endif
+
+  if (event_backend == EVENT_BACKEND_NONE && strcasecmp(wanted, "auto"))
+    Warnx(_("event backend `%s' is not available - falling back to %s"), wanted, event_backend_name());
+
+  Verbose(_("using %s event backend"), event_backend_name());
+
+  if (event_backend == EVENT_BACKEND_NONE) return;
+
+  if (event_kfd >= 0)
+    fcntl(event_kfd, F_SETFD, fcntl(event_kfd, F_GETFD, 0) | FD_CLOEXEC);
+
+  for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++)
+    for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j++)
+      for (t = TaskArray[i][j]->head; t; t = t->next)
+	event_task_update(t);
+}
+/*--- event_init() ------------------------------------------------------------------------------*/
+
+/* vi:set ts=3: */
+/* NEED_PO */
@@ -372,7 +372,7 @@ ixfr_purge_all_soas(TASK *t, void *data) {
   /*
    * Reset task timeout clock to some suitable value in the future
    */
-  t->timeout = current_time + ixfr_gc_interval;	/* Try again e.g. tomorrow */
+  timer_task_set(t, current_time + ixfr_gc_interval);	/* Try again e.g. tomorrow */
 
   querylen = sql_build_query(&query, QUERY0,
 			     mydns_rr_table_name, mydns_rr_active_types[2]);
@@ -438,7 +438,7 @@ ixfr_start() {
     inittask = Ticktask_init(LOW_PRIORITY_TASK, NEED_TASK_RUN, -1, 0, AF_UNSPEC, NULL);
     task_add_extension(inittask, NULL, NULL, NULL, ixfr_purge_all_soas);
 
-    inittask->timeout = current_time + ixfr_gc_delay; /* Run first one in e.g. 10 minutes time */
+    timer_task_set(inittask, current_time + ixfr_gc_delay); /* Run first one in e.g. 10 minutes time */
   }
 }
 
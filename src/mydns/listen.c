@@ -29,18 +29,49 @@
 #endif
 #  include <sys/ioctl.h>
 
+#if HAVE_LINUX_FILTER_H
+#  include <linux/filter.h>
+#endif
+
+#if HAVE_SCHED_H
+#  include <sched.h>
+#endif
+
 
-int *udp4_fd = (int *)NULL;					/* Listening socket: UDP, IPv4 */
-int *tcp4_fd = (int *)NULL;					/* Listening socket: TCP, IPv4 */
-int num_udp4_fd = 0;						/* Number of items in 'udp4_fd' */
-int num_tcp4_fd = 0;						/* Number of items in 'tcp4_fd' */
+THREADLOCAL int *udp4_fd = (int *)NULL;					/* Listening socket: UDP, IPv4 */
+THREADLOCAL int *tcp4_fd = (int *)NULL;					/* Listening socket: TCP, IPv4 */
+THREADLOCAL int num_udp4_fd = 0;						/* Number of items in 'udp4_fd' */
+THREADLOCAL int num_tcp4_fd = 0;						/* Number of items in 'tcp4_fd' */
 
 #if HAVE_IPV6
-int *udp6_fd = (int *)NULL;					/* Listening socket: UDP, IPv6 */
-int *tcp6_fd = (int *)NULL;					/* Listening socket: TCP, IPv6 */
-int num_udp6_fd = 0;						/* Number of items in 'udp6_fd' */
-int num_tcp6_fd = 0;						/* Number of items in 'tcp6_fd' */
+THREADLOCAL int *udp6_fd = (int *)NULL;					/* Listening socket: UDP, IPv6 */
+THREADLOCAL int *tcp6_fd = (int *)NULL;					/* Listening socket: TCP, IPv6 */
+THREADLOCAL int num_udp6_fd = 0;						/* Number of items in 'udp6_fd' */
+THREADLOCAL int num_tcp6_fd = 0;						/* Number of items in 'tcp6_fd' */
+#endif
+
+/*
+ * With 'reuseport' each server process gets its own set of listening sockets, one per
+ * listen address, all bound with SO_REUSEPORT so the kernel spreads the flows across the
+ * servers rather than every server waking for every packet on a shared socket.
+ * The sets are all created by the master before it drops privileges and each server keeps
+ * the set matching its slot, so a restarted server picks up the same sockets again.
+ */
+typedef struct _listenset
+{
+	int			*udp4_fd, *tcp4_fd;
+	int			num_udp4_fd, num_tcp4_fd;
+#if HAVE_IPV6
+	int			*udp6_fd, *tcp6_fd;
+	int			num_udp6_fd, num_tcp6_fd;
 #endif
+} LISTENSET;
+
+static LISTENSET *ListenSets = NULL;				/* One set of sockets per shard */
+static int num_listen_sets = 0;
+
+static int listen_reuseport = 0;				/* Bind with SO_REUSEPORT? */
+static int listen_steer_cpu = 0;				/* Steer packets to the server on their CPU? */
 
 static void server_greeting(void);
 
@@ -517,6 +548,14 @@ ipv4_listener(struct sockaddr_in *sa, int protocol) {
 	 fd,
 	 (protocol == SOCK_STREAM) ? "TCP" : "UDP");
   }
+#ifdef SO_REUSEPORT
+  if (listen_reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    Err(_("ipv4_listener: SO_REUSEPORT failed on socket %d (%s)"),
+	fd,
+	(protocol == SOCK_STREAM) ? "TCP" : "UDP");
+    return -1;
+  }
+#endif
   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
   if (bind(fd, (struct sockaddr *)sa, sizeof(struct sockaddr_in)) < 0) {
     close(fd);
@@ -574,6 +613,14 @@ ipv6_listener(struct sockaddr_in6 *sa, int protocol) {
 	 fd,
 	 (protocol == SOCK_STREAM) ? "TCP" : "UDP");
   }
+#ifdef SO_REUSEPORT
+  if (listen_reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    Err(_("ipv6_listener: SO_REUSEPORT failed on socket %d (%s)"),
+	fd,
+	(protocol == SOCK_STREAM) ? "TCP" : "UDP");
+    return -1;
+  }
+#endif
   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
   if (bind(fd, (struct sockaddr *)sa, sizeof(struct sockaddr_in6)) < 0) {
     close(fd);
@@ -613,17 +660,240 @@ ipv6_listener(struct sockaddr_in6 *sa, int protocol) {
 #endif
 
 
+/**************************************************************************************************
+	LISTEN_ATTACH_STEERING
+	Attach a reuseport program that picks the socket by the CPU the packet arrived on.
+	Socket 'n' of a group belongs to server 'n', which is pinned to CPU 'n', so a server only
+	sees the traffic its own CPU received.  CPUs without a server fall back to the hash.
+**************************************************************************************************/
+static void
+listen_attach_steering(int fd, int protocol) {
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+  struct sock_filter	code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },	/* A = raw_smp_processor_id() */
+    { BPF_RET | BPF_A, 0, 0, 0 },					/* return A */
+  };
+  struct sock_fprog	prog = { sizeof(code) / sizeof(code[0]), code };
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+    Warn(_("listen_attach_steering: failed to attach CPU steering to socket %d (%s)"),
+	 fd,
+	 (protocol == SOCK_STREAM) ? "TCP" : "UDP");
+#if DEBUG_ENABLED && DEBUG_LISTEN
+  else
+    DebugX("listen", 1, _("attached CPU steering to socket %d (%s)"), fd,
+	   (protocol == SOCK_STREAM) ? "TCP" : "UDP");
+#endif
+#else
+  static int warned = 0;
+
+  if (!warned++)
+    Warnx(_("reuseport-cpu is not supported on this platform - using the kernel hash"));
+#endif
+}
+/*--- listen_attach_steering() ------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_ADD_ADDRESS
+	Create the UDP (and TCP) listening sockets for one address and add them to 'set'.
+**************************************************************************************************/
+static void
+listen_add_address(LISTENSET *set, ADDRLIST *L, int first) {
+  int		fd = -1;
+
+  if (L->family == AF_INET) {
+    struct sockaddr_in sa;
+
+    memset(&sa, 0, sizeof(struct sockaddr_in));
+
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(L->port);
+    memcpy(&sa.sin_addr, &L->addr4, sizeof(struct in_addr));
+
+    /* Expand FD lists as appropriate and create listening sockets */
+    fd = ipv4_listener(&sa, SOCK_DGRAM);
+    if (first && listen_steer_cpu) listen_attach_steering(fd, SOCK_DGRAM);
+    set->udp4_fd = REALLOCATE(set->udp4_fd, (1 + set->num_udp4_fd) * sizeof(int), int[]);
+    set->udp4_fd[set->num_udp4_fd++] = fd;
+
+    if (axfr_enabled || tcp_enabled) {
+      fd = ipv4_listener(&sa, SOCK_STREAM);
+      if (first && listen_steer_cpu) listen_attach_steering(fd, SOCK_STREAM);
+      set->tcp4_fd = REALLOCATE(set->tcp4_fd, (1 + set->num_tcp4_fd) * sizeof(int), int[]);
+      set->tcp4_fd[set->num_tcp4_fd++] = fd;
+    }
+  }
+#if HAVE_IPV6
+  else if (L->family == AF_INET6) {
+    struct sockaddr_in6 sa;
+
+    memset(&sa, 0, sizeof(struct sockaddr_in6));
+    sa.sin6_family = AF_INET6;
+    sa.sin6_port = htons(L->port);
+    memcpy(&sa.sin6_addr, &L->addr6, sizeof(struct in6_addr));
+#if 0
+    /* These two vars are part of struct sockaddr_in6, but I don't know what they are: */
+    uint32_t sin6_flowinfo = 0;   /* IPv6 flow information */
+    uint32_t sin6_scope_id = 0;   /* IPv6 scope-id */
+#endif
+
+    /* Expand FD lists as appropriate and create listening sockets */
+    fd = ipv6_listener(&sa, SOCK_DGRAM);
+    if (first && listen_steer_cpu) listen_attach_steering(fd, SOCK_DGRAM);
+    set->udp6_fd = REALLOCATE(set->udp6_fd, (1 + set->num_udp6_fd) * sizeof(int), int[]);
+    set->udp6_fd[set->num_udp6_fd++] = fd;
+      
+    if (axfr_enabled || tcp_enabled) {
+      fd = ipv6_listener(&sa, SOCK_STREAM);
+      if (first && listen_steer_cpu) listen_attach_steering(fd, SOCK_STREAM);
+      set->tcp6_fd = REALLOCATE(set->tcp6_fd, (1 + set->num_tcp6_fd) * sizeof(int), int[]);
+      set->tcp6_fd[set->num_tcp6_fd++] = fd;
+    }
+  }
+#endif
+}
+/*--- listen_add_address() ----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_USE_SET
+	Make set 'n' the listening sockets used by this process.
+**************************************************************************************************/
+static void
+listen_use_set(int n) {
+  LISTENSET	*set = &ListenSets[n];
+
+  udp4_fd = set->udp4_fd;
+  num_udp4_fd = set->num_udp4_fd;
+  tcp4_fd = set->tcp4_fd;
+  num_tcp4_fd = set->num_tcp4_fd;
+#if HAVE_IPV6
+  udp6_fd = set->udp6_fd;
+  num_udp6_fd = set->num_udp6_fd;
+  tcp6_fd = set->tcp6_fd;
+  num_tcp6_fd = set->num_tcp6_fd;
+#endif
+}
+/*--- listen_use_set() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_CLOSE_SET
+	Close the sockets in set 'n' - plain close() the other processes may still be using them.
+**************************************************************************************************/
+static void
+listen_close_set(int n) {
+  LISTENSET	*set = &ListenSets[n];
+  int		i = 0;
+
+  for (i = 0; i < set->num_udp4_fd; i++) close(set->udp4_fd[i]);
+  for (i = 0; i < set->num_tcp4_fd; i++) close(set->tcp4_fd[i]);
+  RELEASE(set->udp4_fd);
+  RELEASE(set->tcp4_fd);
+  set->num_udp4_fd = set->num_tcp4_fd = 0;
+#if HAVE_IPV6
+  for (i = 0; i < set->num_udp6_fd; i++) close(set->udp6_fd[i]);
+  for (i = 0; i < set->num_tcp6_fd; i++) close(set->tcp6_fd[i]);
+  RELEASE(set->udp6_fd);
+  RELEASE(set->tcp6_fd);
+  set->num_udp6_fd = set->num_tcp6_fd = 0;
+#endif
+}
+/*--- listen_close_set() ------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_PIN_CPU
+	When steering by CPU, pin the calling server process or thread to CPU 'n', the CPU its
+	sockets are steered from.
+**************************************************************************************************/
+static void
+listen_pin_cpu(int n) {
+#if HAVE_SCHED_SETAFFINITY && defined(CPU_SET)
+  if (listen_steer_cpu) {
+    cpu_set_t	cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(n, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+      Warn(_("server %d: failed to pin to CPU %d"), n, n);
+    else
+      Verbose(_("server %d: pinned to CPU %d"), n, n);
+  }
+#endif
+}
+/*--- listen_pin_cpu() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_SERVER_START
+	Called in a newly forked server.  Keep only the listening sockets of server 'n' and, when
+	steering by CPU, pin the server to the CPU its sockets are steered from.
+**************************************************************************************************/
+void
+listen_server_start(int n) {
+  int		i = 0;
+
+  if (num_listen_sets <= 1) return;
+
+  n %= num_listen_sets;
+
+  for (i = 0; i < num_listen_sets; i++)
+    if (i != n) listen_close_set(i);
+
+  listen_use_set(n);
+  listen_pin_cpu(n);
+}
+/*--- listen_server_start() ---------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_THREAD_START
+	Called in a newly started server thread.  The listening fd lists are per thread, point this
+	thread's lists at the sockets of server 'n' - the other sets stay open for the other threads.
+	Without sharded sockets every thread listens on set 0.
+**************************************************************************************************/
+void
+listen_thread_start(int n) {
+  n = (num_listen_sets > 1) ? (n % num_listen_sets) : 0;
+
+  listen_use_set(n);
+  if (num_listen_sets > 1)
+    listen_pin_cpu(n);
+}
+/*--- listen_thread_start() ---------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	LISTEN_CLOSE_OTHERS
+	Called by the master (or the main thread) at shutdown to close the sets not held in the
+	listening fd lists.
+**************************************************************************************************/
+void
+listen_close_others(void) {
+  int		i = 0;
+
+  for (i = 1; i < num_listen_sets; i++)
+    listen_close_set(i);
+}
+/*--- listen_close_others() ---------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	CREATE_LISTENERS
+	'servers' is the number of server processes that will be started, with 'reuseport'
+	each of them gets its own set of sockets.
 **************************************************************************************************/
 void
-create_listeners(void) {
+create_listeners(int servers) {
   ADDRLIST	*Addresses = NULL;				/* List of available addresses */
   ADDRLIST	*Listen = NULL;					/* Listen on these addresses */
   ADDRLIST	*NoListen = NULL;				/* Don't listen on these addresses */
   ADDRLIST	*L = NULL, *N = NULL;				/* Current address */
   const char	*port_opt = conf_get(&Conf, "port", 0);		/* "port" config option */
   int		port = 53;					/* Listen on this port number */
+  int		n = 0;
 
   /* Set default port number */
   if (port_opt && atoi(port_opt))
@@ -679,54 +949,30 @@ create_listeners(void) {
   addrlist_free(Addresses);
   addrlist_free(NoListen);
 
-  /* Create listening socket for each address in 'Listen' */
-  for (L = Listen; L; L = L->next) {
-    if (!L->ok)
-      continue;
-
-    if (L->family == AF_INET) {
-      struct sockaddr_in sa;
-
-      memset(&sa, 0, sizeof(struct sockaddr_in));
+  listen_reuseport = 0;
+  listen_steer_cpu = 0;
+  num_listen_sets = 1;
 
-      sa.sin_family = AF_INET;
-      sa.sin_port = htons(L->port);
-      memcpy(&sa.sin_addr, &L->addr4, sizeof(struct in_addr));
-
-      /* Expand FD lists as appropriate and create listening sockets */
-      udp4_fd = REALLOCATE(udp4_fd, (1 + num_udp4_fd) * sizeof(int), int[]);
-      udp4_fd[num_udp4_fd++] = ipv4_listener(&sa, SOCK_DGRAM);
+  if (servers > 1 && GETBOOL(conf_get(&Conf, "reuseport", NULL))) {
+#ifdef SO_REUSEPORT
+    listen_reuseport = 1;
+    num_listen_sets = servers;
+    listen_steer_cpu = GETBOOL(conf_get(&Conf, "reuseport-cpu", NULL));
+#else
+    Warnx(_("reuseport is not supported on this platform - servers will share listening sockets"));
+#endif
+  }
 
-      if (axfr_enabled || tcp_enabled) {
-	tcp4_fd = REALLOCATE(tcp4_fd, (1 + num_tcp4_fd) * sizeof(int), int[]);
-	tcp4_fd[num_tcp4_fd++] = ipv4_listener(&sa, SOCK_STREAM);
-      }
-    }
-#if HAVE_IPV6
-    else if (L->family == AF_INET6) {
-      struct sockaddr_in6 sa;
+  ListenSets = (LISTENSET*)ALLOCATE(num_listen_sets * sizeof(LISTENSET), LISTENSET[]);
 
-      memset(&sa, 0, sizeof(struct sockaddr_in6));
-      sa.sin6_family = AF_INET6;
-      sa.sin6_port = htons(L->port);
-      memcpy(&sa.sin6_addr, &L->addr6, sizeof(struct in6_addr));
-#if 0
-      /* These two vars are part of struct sockaddr_in6, but I don't know what they are: */
-      uint32_t sin6_flowinfo = 0;   /* IPv6 flow information */
-      uint32_t sin6_scope_id = 0;   /* IPv6 scope-id */
-#endif
+  /* Create listening socket for each address in 'Listen' - the first set made for an address
+     is the first member of its SO_REUSEPORT group and carries the steering program */
+  for (n = 0; n < num_listen_sets; n++)
+    for (L = Listen; L; L = L->next)
+      if (L->ok)
+	listen_add_address(&ListenSets[n], L, (n == 0));
 
-      /* Expand FD lists as appropriate and create listening sockets */
-      udp6_fd = REALLOCATE(udp6_fd, (1 + num_udp6_fd) * sizeof(int), int[]);
-      udp6_fd[num_udp6_fd++] = ipv6_listener(&sa, SOCK_DGRAM);
-      
-      if (axfr_enabled || tcp_enabled) {
-	tcp6_fd = REALLOCATE(tcp6_fd, (1 + num_tcp6_fd) * sizeof(int), int[]);
-	tcp6_fd[num_tcp6_fd++] = ipv6_listener(&sa, SOCK_STREAM);
-      }
-    }
-#endif
-  }
+  listen_use_set(0);
 
   server_greeting();
   addrlist_free(Listen);
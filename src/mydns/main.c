@@ -21,35 +21,37 @@
 #include "named.h"
 
 
-QUEUE 		*TaskArray[PERIODIC_TASK+1][LOW_PRIORITY_TASK+1];
+THREADLOCAL QUEUE	*TaskArray[PERIODIC_TASK+1][LOW_PRIORITY_TASK+1];
 
-struct timeval	current_tick;			/* Current micro-second time */
-time_t		current_time;			/* Current time */
+THREADLOCAL struct timeval current_tick;	/* Current micro-second time */
+THREADLOCAL time_t	current_time;	/* Current time */
 
 static int	servers = 0;			/* Number of server processes to run */
 ARRAY		*Servers = NULL;
 
+static int	threads = 0;			/* Number of server threads to run */
+
 static int	got_sigusr1 = 0,
 	   	got_sigusr2 = 0,
 	   	got_sighup = 0,
 	   	got_sigalrm = 0,		/* Signal flags */
 	   	got_sigchld = 0;		/* Signal flags */
-static int 	shutting_down = 0;		/* Shutdown in progress? */
+static volatile int shutting_down = 0;	/* Shutdown in progress? */
 
 int		run_as_root = 0;		/* Run as root user? */
 uint32_t 	answer_then_quit = 0;		/* Answer this many queries then quit */
 char		hostname[256];			/* Hostname of local machine */
 
-extern int	*tcp4_fd, *udp4_fd;		/* Listening FD's (IPv4) */
-extern int	num_tcp4_fd, num_udp4_fd;	/* Number of listening FD's (IPv4) */
+extern THREADLOCAL int *tcp4_fd, *udp4_fd;	/* Listening FD's (IPv4) */
+extern THREADLOCAL int num_tcp4_fd, num_udp4_fd;	/* Number of listening FD's (IPv4) */
 #if HAVE_IPV6
-extern int	*tcp6_fd, *udp6_fd;		/* Listening FD's (IPv6) */
-extern int	num_tcp6_fd, num_udp6_fd;	/* Number of listening FD's (IPv6) */
+extern THREADLOCAL int *tcp6_fd, *udp6_fd;	/* Listening FD's (IPv6) */
+extern THREADLOCAL int num_tcp6_fd, num_udp6_fd;	/* Number of listening FD's (IPv6) */
 #endif
 
 int		show_data_errors = 1;		/* Output data errors? */
 
-SERVERSTATUS	Status;				/* Server status information */
+THREADLOCAL SERVERSTATUS Status;	/* Server status information */
 
 
 typedef void (*INITIALTASKSTART)(void);
@@ -75,7 +77,34 @@ INITIALTASK	process_initial_tasks[] = {
   { NULL,		NULL }
 };
 
-static SERVER	*spawn_server(INITIALTASK *);
+static SERVER	*spawn_server(INITIALTASK *, int);
+
+#if USE_THREADS
+/*
+ * With `threads' the servers are threads of this process instead of forked children.
+ * The main thread runs server 0 together with the master's tasks and is the only one that
+ * handles signals; the other threads block them and are woken with SIGALRM to stop.
+ */
+typedef struct _server_thread {
+  pthread_t		tid;
+  int			slot;
+  volatile int		running;
+  SERVERSTATUS		*status;			/* The thread's Status while it runs */
+  SERVERSTATUS		final;				/* ..and a copy once it has stopped */
+} SERVERTHREAD;
+
+static SERVERTHREAD	*Threads = NULL;
+static THREADLOCAL SERVERTHREAD *this_thread = NULL;	/* NULL in the main thread */
+
+static pthread_mutex_t	thread_start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	thread_started = PTHREAD_COND_INITIALIZER;
+
+#define MAIN_THREAD	(!this_thread)
+
+static void		threads_stop(void);
+#else
+#define MAIN_THREAD	1
+#endif
 
 /**************************************************************************************************
 	USAGE
@@ -108,6 +137,7 @@ usage(int status) {
     puts(_("      --debug-*[=n]       enable debug output for module"));
 #endif
     puts(_("  -v, --verbose           be more verbose while running"));
+    puts(_("      --threads=N         run N server threads instead of server processes"));
     puts(_("      --no-data-errors    don't output errors about bad data"));
     puts(_("      --help              display this help and exit"));
     puts(_("      --version           output version information and exit"));
@@ -143,6 +173,7 @@ cmdline(int argc, char **argv) {
 
     {"debug",			no_argument,			NULL,	'd'},
     {"verbose",			no_argument,			NULL,	'v'},
+    {"threads",			required_argument,		NULL,	0},
     {"help",			no_argument,			NULL,	0},
     {"version",			no_argument,			NULL,	0},
 
@@ -216,6 +247,8 @@ cmdline(int argc, char **argv) {
 	  run_as_root = 1;
 	else if (!strcmp(opt, "no-data-errors"))	/* --no-data-errors */
 	  show_data_errors = 0;
+	else if (!strcmp(opt, "threads"))		/* --threads */
+	  conf_set(&Conf, "threads", optarg, 0);
 #if DEBUG_ENABLED
 	else if (!strncmp(opt, "debug-", 6)) { /* --debug-* */
 	  err_verbose = err_debug = 1;
@@ -383,25 +416,60 @@ create_pidfile(void) {
 void
 server_status(void) {
   char			buf[1024], *b = buf;
-  time_t		uptime = time(NULL) - Status.start_time;
-  unsigned long 	requests = Status.udp_requests + Status.tcp_requests;
+  SERVERSTATUS		*S = &Status;
+  time_t		uptime = 0;
+  unsigned long 	requests = 0;
+#if USE_THREADS
+  SERVERSTATUS		total;
+  int			n = 0, r = 0;
+
+  /* Report the process as a whole - add in the other threads' figures */
+  if (Threads) {
+    memcpy(&total, &Status, sizeof(SERVERSTATUS));
+    for (n = 1; n < threads; n++) {
+      SERVERSTATUS *T = Threads[n].status;
+
+      if (!T) continue;
+      total.udp_requests += T->udp_requests;
+      total.tcp_requests += T->tcp_requests;
+      total.timedout += T->timedout;
+      total.udp_recv_calls += T->udp_recv_calls;
+      total.udp_recv_msgs += T->udp_recv_msgs;
+      total.udp_send_calls += T->udp_send_calls;
+      total.udp_send_msgs += T->udp_send_msgs;
+      for (r = 0; r < MAX_RESULTS; r++)
+	total.results[r] += T->results[r];
+    }
+    S = &total;
+  }
+#endif
+
+  uptime = time(NULL) - S->start_time;
+  requests = S->udp_requests + S->tcp_requests;
 
   b += snprintf(b, sizeof(buf)-(b-buf), "%s ", hostname);
   b += snprintf(b, sizeof(buf)-(b-buf), "%s %s (%lus) ", _("up"), strsecs(uptime),
 		(unsigned long)uptime);
   b += snprintf(b, sizeof(buf)-(b-buf), "%lu %s ", requests, _("questions"));
   b += snprintf(b, sizeof(buf)-(b-buf), "(%.0f/s) ", requests ? AVG(requests, uptime) : 0.0);
-  b += snprintf(b, sizeof(buf)-(b-buf), "NOERROR=%u ", Status.results[DNS_RCODE_NOERROR]);
-  b += snprintf(b, sizeof(buf)-(b-buf), "SERVFAIL=%u ", Status.results[DNS_RCODE_SERVFAIL]);
-  b += snprintf(b, sizeof(buf)-(b-buf), "NXDOMAIN=%u ", Status.results[DNS_RCODE_NXDOMAIN]);
-  b += snprintf(b, sizeof(buf)-(b-buf), "NOTIMP=%u ", Status.results[DNS_RCODE_NOTIMP]);
-  b += snprintf(b, sizeof(buf)-(b-buf), "REFUSED=%u ", Status.results[DNS_RCODE_REFUSED]);
+  b += snprintf(b, sizeof(buf)-(b-buf), "NOERROR=%u ", S->results[DNS_RCODE_NOERROR]);
+  b += snprintf(b, sizeof(buf)-(b-buf), "SERVFAIL=%u ", S->results[DNS_RCODE_SERVFAIL]);
+  b += snprintf(b, sizeof(buf)-(b-buf), "NXDOMAIN=%u ", S->results[DNS_RCODE_NXDOMAIN]);
+  b += snprintf(b, sizeof(buf)-(b-buf), "NOTIMP=%u ", S->results[DNS_RCODE_NOTIMP]);
+  b += snprintf(b, sizeof(buf)-(b-buf), "REFUSED=%u ", S->results[DNS_RCODE_REFUSED]);
 
   /* If the server is getting TCP queries, report on the percentage of TCP queries */
-  if (Status.tcp_requests)
+  if (S->tcp_requests)
     b += snprintf(b, sizeof(buf)-(b-buf), "(%d%% TCP, %lu queries)",
-		  (int)PCT(requests, Status.tcp_requests),
-		  (unsigned long)Status.tcp_requests);
+		  (int)PCT(requests, S->tcp_requests),
+		  (unsigned long)S->tcp_requests);
+
+  /* Average fill of the batched UDP reads and writes */
+  if (S->udp_recv_calls)
+    b += snprintf(b, sizeof(buf)-(b-buf), " (UDP batch fill %.1f in %.1f out of %d)",
+		  (double)S->udp_recv_msgs / S->udp_recv_calls,
+		  S->udp_send_calls ? (double)S->udp_send_msgs / S->udp_send_calls : 0.0,
+		  udp_batch_size);
 
   Notice("%s", buf);
 }
@@ -575,6 +643,11 @@ void
 named_shutdown(int signo) {
   int n = 0;
 
+#if USE_THREADS
+  /* Stop the other server threads first so their figures are in the final status */
+  threads_stop();
+#endif
+
   switch (signo) {
   case 0:
     Notice(_("Normal shutdown")); break;
@@ -615,6 +688,11 @@ named_shutdown(int signo) {
     close(udp6_fd[n]);
 #endif	/* HAVE_IPV6 */
 
+#if USE_THREADS
+  /* The other threads' listening sockets belong to this process too */
+  if (Threads)
+    listen_close_others();
+#endif
 }
 
 static void
@@ -681,6 +759,9 @@ master_shutdown(int signo) {
     sockclose(udp6_fd[n]);
 #endif	/* HAVE_IPV6 */
 
+  /* And the listening sockets held for the other servers, if any */
+  listen_close_others();
+
   unlink(conf_get(&Conf, "pidfile", NULL));
 }
 
@@ -750,8 +831,8 @@ master_child_cleanup(int signo) {
 	  close(server->serverfd);
 	  RELEASE(server);
 	  array_store(Servers, n, NULL);
-	  if (n == 0) server = spawn_server(primary_initial_tasks);
-	  else server = spawn_server(process_initial_tasks);
+	  if (n == 0) server = spawn_server(primary_initial_tasks, n);
+	  else server = spawn_server(process_initial_tasks, n);
 	  server->listener = mcomms_start(server->serverfd);
 	  array_store(Servers, n, server);
 	}
@@ -848,6 +929,22 @@ gettick() {
   return (&current_tick);
 }
 
+/**************************************************************************************************
+	TASK_QUEUES_INIT
+	Create the task queues of this server (thread).
+**************************************************************************************************/
+static void
+task_queues_init(void) {
+  int i = 0, j = 0;
+
+  for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++) {
+    for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j ++) {
+      TaskArray[i][j] = queue_init(task_type_name(i), task_priority_name(j));
+    }
+  }
+}
+/*--- task_queues_init() ------------------------------------------------------------------------*/
+
 static void
 do_initial_tasks(INITIALTASK *initial_tasks) {
   int i = 0;
@@ -877,40 +974,12 @@ buildIOtaskItem(TASK *t) {
   return item;
 }
 
-static taskexec_t
-checkTaskTimedOut(TASK *t, int *timeoutWanted) {
-  taskexec_t	res = TASK_DID_NOT_EXECUTE;
-
-  if (TASKTIMESOUT(t->status)) {
-    time_t	timedOut = t->timeout - current_time;
-    if (timedOut <= 0) {
-      res = task_timedout(t);
-      if ((res == TASK_CONTINUE)
-	  || (res == TASK_EXECUTED)
-	  || (res == TASK_DID_NOT_EXECUTE)) {
-	timedOut = t->timeout - current_time;
-	if (timedOut < 0) timedOut = 0;
-      } else {
-	return res;
-      }
-    }
-    if (timedOut < *timeoutWanted || *timeoutWanted == -1)
-      *timeoutWanted = timedOut;
-  }
-  return res;
-}
-
 static void
 scheduleTask(TASK *t,
 	     struct pollfd *items[],
 	     int *timeoutWanted, int *numfds, int *maxnumfds) {
-  taskexec_t	res = checkTaskTimedOut(t, timeoutWanted);
   struct pollfd	*item = NULL;
 
-  if ((res != TASK_CONTINUE)
-      && (res != TASK_EXECUTED)
-      && (res != TASK_DID_NOT_EXECUTE)) return;
-
   if ((t->status & Needs2Exec) && (t->type != PERIODIC_TASK))
     *timeoutWanted = 0;
 
@@ -957,6 +1026,11 @@ static void
 scheduleTasks(struct pollfd *items[], int *timeoutWanted, int *numfds, int *maxnumfds) {
   int i = 0, j = 0;
 
+  /* Expire timed out tasks first, only those whose deadline has passed are touched */
+  timer_run();
+  *timeoutWanted = timer_next();
+  if (udp_pending()) *timeoutWanted = 0;
+
   for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++) {
     for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j++) {
       scheduleTaskQ(TaskArray[i][j], items, timeoutWanted, numfds, maxnumfds);
@@ -1027,6 +1101,7 @@ run_tasks(struct pollfd items[], int numfds) {
     }
     if (shutting_down) break;
   }
+  udp_flush();
   queue_stats();
   return tasks_executed;
 }
@@ -1104,11 +1179,79 @@ purge_bad_tasks(void) {
 #endif
 }
 
+static int
+run_ready_tasks(void) {
+  int tasks_executed = 0;
+  int rfd = 0, wfd = 0, efd = 0;
+  TASK *t = NULL;
+
+  while ((t = event_next_ready(&rfd, &wfd, &efd))) {
+    if (efd) {
+#if DEBUG_ENABLED
+      DebugX("enabled", 1, _("%s: purge_bad_task on fd %d has error indication"), desctask(t), t->fd);
+#endif
+      purge_bad_task(t);
+      continue;
+    }
+    tasks_executed += task_process(t, rfd, wfd, efd);
+    if (shutting_down) break;
+  }
+  udp_flush();
+  queue_stats();
+  return tasks_executed;
+}
+
+/**************************************************************************************************
+	EVENT_LOOP_ONCE
+	One pass of the main loop on a persistent event backend.  The fds are already registered
+	so only tasks that have IO ready or can run without IO are dispatched.
+	'wakeup' caps the wait in milliseconds, -1 for no cap.
+**************************************************************************************************/
+static void
+event_loop_once(int wakeup) {
+  int	timeoutWanted = -1;
+  int	rv = 0;
+
+  timer_run();
+  if (shutting_down) return;
+
+  timeoutWanted = timer_next();
+  if (timeoutWanted > 0) timeoutWanted *= 1000;
+  if (event_pending() || udp_pending())
+    timeoutWanted = 0;
+  else if (wakeup >= 0 && (timeoutWanted < 0 || wakeup < timeoutWanted))
+    timeoutWanted = wakeup;
+
+#if DEBUG_ENABLED
+  DebugX("enabled", 1, _("Waiting for IO using %s, timeout = %d"), event_backend_name(), timeoutWanted);
+#endif
+
+  rv = event_wait(timeoutWanted);
+
+  if (rv < 0) {
+    if (errno == EINTR) return;
+    if (errno == EAGAIN) { /* Could fail here but will log and retry */
+      Warn(_("event_loop_once() received EAGAIN - retrying"));
+      return;
+    }
+    Err("%s", event_backend_name());
+  }
+
+  gettick();
+
+  if (shutting_down) return;
+
+  run_ready_tasks();
+}
+/*--- event_loop_once() -------------------------------------------------------------------------*/
+
 static void
 server_loop(INITIALTASK *initial_tasks, int serverfd) {
   struct pollfd	*items = NULL;
   int maxnumfds = 0;
 
+  event_init();
+
   do_initial_tasks(initial_tasks);
 
   udp_start();
@@ -1127,16 +1270,23 @@ server_loop(INITIALTASK *initial_tasks, int serverfd) {
     struct timeval	tv = { 0, 0 };
     struct timeval	*tvp = NULL;
 
-    /* Handle signals */
-    if (got_sighup) sighup(SIGHUP);
-    if (got_sigusr1) sigusr1(SIGUSR1);
-    if (got_sigusr2) sigusr2(SIGUSR2);
-    if (got_sigchld) child_cleanup(SIGCHLD);
+    /* Handle signals - with threads they are all taken by the main thread */
+    if (MAIN_THREAD) {
+      if (got_sighup) sighup(SIGHUP);
+      if (got_sigusr1) sigusr1(SIGUSR1);
+      if (got_sigusr2) sigusr2(SIGUSR2);
+      if (got_sigchld) child_cleanup(SIGCHLD);
+    }
 
     if(shutting_down) { break; }
 
     gettick();
 
+    if (event_active()) {
+      event_loop_once(-1);
+      continue;
+    }
+
     scheduleTasks(&items, &timeoutWanted, &numfds, &maxnumfds);
 
 #if DEBUG_ENABLED    
@@ -1265,12 +1415,16 @@ server_loop(INITIALTASK *initial_tasks, int serverfd) {
   }
 
   RELEASE(items);
-  named_shutdown(shutting_down);
 
+  /* The main thread shuts down the process, another thread just stops */
+  if (MAIN_THREAD)
+    named_shutdown(shutting_down);
+  else
+    free_all_tasks();
 }
 
 static SERVER *
-spawn_server(INITIALTASK *initial_tasks) {
+spawn_server(INITIALTASK *initial_tasks, int slot) {
   pid_t	pid = -1;
   int	fd[2] = { -1, -1 };
   int	masterfd = -1, serverfd = -1;
@@ -1332,6 +1486,12 @@ spawn_server(INITIALTASK *initial_tasks) {
 
   close(masterfd);
 
+  /* Keep only this server's own listening sockets when they are sharded */
+  listen_server_start(slot);
+
+  /* The master's event set is shared across the fork - drop it before freeing its tasks */
+  event_reset();
+
   /* Delete pre-existing tasks as they belong to master */
   free_all_tasks();
 #if DEBUG_ENABLED
@@ -1349,12 +1509,128 @@ spawn_server(INITIALTASK *initial_tasks) {
   /*NOTREACHED*/
 }
 
+#if USE_THREADS
+/**************************************************************************************************
+	SERVER_THREAD
+	Body of a server thread: its own task queues, listening sockets and database connection,
+	then the usual server loop.
+**************************************************************************************************/
+static void *
+server_thread(void *arg) {
+  SERVERTHREAD	*thr = (SERVERTHREAD *)arg;
+  sigset_t	mask;
+
+  /* Leave the signals to the main thread - SIGALRM stays open to wake this one up */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGHUP);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGQUIT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  this_thread = thr;
+  thr->status = &Status;
+
+  gettick();
+  time(&Status.start_time);
+
+  task_queues_init();
+  listen_thread_start(thr->slot);
+  db_connect();
+
+  /* Let the main thread start the next one - connecting is not thread safe */
+  pthread_mutex_lock(&thread_start_lock);
+  thr->running = 1;
+  pthread_cond_signal(&thread_started);
+  pthread_mutex_unlock(&thread_start_lock);
+
+#if DEBUG_ENABLED
+  DebugX("enabled", 1, _("server thread %d started"), thr->slot);
+#endif
+
+  server_loop(process_initial_tasks, -1);
+
+  sql_close(sql);
+
+  memcpy(&thr->final, &Status, sizeof(SERVERSTATUS));
+  thr->status = &thr->final;
+  thr->running = 0;
+
+  return (NULL);
+}
+/*--- server_thread() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	SPAWN_THREADS
+	Start server threads 1 to threads-1, the main thread is server 0.
+	Each is started only once the one before it is up.
+**************************************************************************************************/
+static void
+spawn_threads(void) {
+  int		n = 0, rv = 0;
+
+  Threads = (SERVERTHREAD *)ALLOCATE(threads * sizeof(SERVERTHREAD), SERVERTHREAD[]);
+  Threads[0].status = &Status;
+
+  for (n = 1; n < threads; n++) {
+    SERVERTHREAD *thr = &Threads[n];
+
+    thr->slot = n;
+
+    pthread_mutex_lock(&thread_start_lock);
+    if ((rv = pthread_create(&thr->tid, NULL, server_thread, thr))) {
+      errno = rv;
+      Err(_("pthread_create"));
+    }
+    while (!thr->running)
+      pthread_cond_wait(&thread_started, &thread_start_lock);
+    pthread_mutex_unlock(&thread_start_lock);
+  }
+
+  Verbose(_("%d server threads started"), threads);
+}
+/*--- spawn_threads() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	THREADS_STOP
+	Called by the main thread at shutdown.  shutting_down is already set, keep waking each
+	thread until it has seen it - it may have been about to wait when the first SIGALRM came.
+**************************************************************************************************/
+static void
+threads_stop(void) {
+  int		n = 0;
+
+  if (!Threads) return;
+
+  for (n = 1; n < threads; n++) {
+    SERVERTHREAD *thr = &Threads[n];
+
+    if (!thr->slot) continue;				/* Never started */
+    while (thr->running) {
+      pthread_kill(thr->tid, SIGALRM);
+      usleep(10000);
+    }
+    pthread_join(thr->tid, NULL);
+    thr->slot = 0;
+  }
+}
+/*--- threads_stop() ----------------------------------------------------------------------------*/
+#endif
+
+
 static void
 master_loop(INITIALTASK *initial_tasks) {
   int	i;
   struct pollfd	*items = NULL;
   int maxnumfds = 0;
 
+  event_init();
+
   do_initial_tasks(initial_tasks);
 
   for (i = 0; i < array_numobjects(Servers); i++) {
@@ -1379,6 +1655,12 @@ master_loop(INITIALTASK *initial_tasks) {
 
     gettick();
 
+    if (event_active()) {
+      /* If we have a high priority normal task to run then wake up in 1/100th second */
+      event_loop_once(TaskArray[NORMAL_TASK][HIGH_PRIORITY_TASK]->head ? 10 : -1);
+      continue;
+    }
+
     scheduleTasks(&items, &timeoutWanted, &numfds, &maxnumfds);
 		  
 #if DEBUG_ENABLED    
@@ -1557,16 +1839,35 @@ main(int argc, char **argv)
   db_connect();
   create_pidfile();					/* Create PID file */
 
-  for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++) {
-    for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j ++) {
-      TaskArray[i][j] = queue_init(task_type_name(i), task_priority_name(j));
-    }
+  task_queues_init();
+
+  /* Spawn a process for each server, use multicpu if servers == 1 and multicpu is not -1 */
+  servers = atoi(conf_get(&Conf, "servers", NULL));
+  if (servers <= 1) {
+    int multicpu = atoi(conf_get(&Conf, "multicpu", NULL));
+    if (multicpu > 1) servers = multicpu;
   }
+    
+  if (servers < 0) servers = 1;
 
-  cache_init();						/* Initialize cache */
+  /* Server threads replace the server processes */
+  threads = atoi(conf_get(&Conf, "threads", NULL));
+  if (threads > 1) {
+#if USE_THREADS
+    servers = 0;
+#else
+    Warnx(_("threads are not supported on this platform - running %d server processes instead"),
+	  threads);
+    servers = threads;
+    threads = 0;
+#endif
+  } else
+    threads = 0;
+
+  cache_init(servers > 1, threads > 1);			/* Initialize cache, shared between servers */
 
   /* Start listening fd's */
-  create_listeners();
+  create_listeners(threads ? threads : servers);
 
   time(&Status.start_time);
 
@@ -1595,27 +1896,22 @@ main(int argc, char **argv)
 
   gettick();
 
-  /* Spawn a process for each server, use multicpu if servers == 1 and multicpu is not -1 */
-  servers = atoi(conf_get(&Conf, "servers", NULL));
-  if (servers <= 1) {
-    int multicpu = atoi(conf_get(&Conf, "multicpu", NULL));
-    if (multicpu > 1) servers = multicpu;
-  }
-    
-  if (servers < 0) servers = 1;
-
   Servers = array_init(servers);
 
   if (servers) {
-    array_append(Servers, (void*)spawn_server(primary_initial_tasks));
+    array_append(Servers, (void*)spawn_server(primary_initial_tasks, 0));
 
     for (n = 1; n < servers; n++) {
-      array_append(Servers, (void*)spawn_server(process_initial_tasks));
+      array_append(Servers, (void*)spawn_server(process_initial_tasks, n));
     }
   
     master_loop(master_initial_tasks);
   } else {
     do_initial_tasks(master_initial_tasks);
+#if USE_THREADS
+    if (threads)
+      spawn_threads();
+#endif
     server_loop(primary_initial_tasks, -1);
   }
 
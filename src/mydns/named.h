@@ -96,10 +96,12 @@ typedef struct _serverstatus									/* Server status information */
 	time_t	start_time;	 										/* Time server started */
 	uint32_t	udp_requests, tcp_requests;					/* Total # of requests handled */
 	uint32_t	timedout;	 										/* Number of requests that timed out */
+	uint32_t	udp_recv_calls, udp_recv_msgs;				/* Batched UDP reads and datagrams read */
+	uint32_t	udp_send_calls, udp_send_msgs;				/* Batched UDP writes and replies sent */
 	uint32_t	results[MAX_RESULTS];							/* Result codes */
 } SERVERSTATUS;
 
-extern SERVERSTATUS Status;
+extern THREADLOCAL SERVERSTATUS Status;
 
 typedef struct _named_server {
   pid_t		pid;
@@ -112,12 +114,12 @@ extern ARRAY	*Servers;
 
 
 /* Global variables */
-extern QUEUE	*TaskArray[PERIODIC_TASK+1][LOW_PRIORITY_TASK+1];
+extern THREADLOCAL QUEUE *TaskArray[PERIODIC_TASK+1][LOW_PRIORITY_TASK+1];
 
 extern int	max_used_fd;
 
 extern CACHE	*Cache;				/* Zone cache */
-extern time_t	current_time;			/* Current time */
+extern THREADLOCAL time_t current_time;			/* Current time */
 
 #if ALIAS_ENABLED
 /* alias.c */
@@ -146,6 +148,7 @@ extern MYDNS_RR		*find_rr(TASK *, MYDNS_SOA *, dns_qtype_t, const char *);
 /* encode.c */
 extern int		name_remember(TASK *, const char *, unsigned int);
 extern void		name_forget(TASK *);
+extern void		name_free(TASK *);
 extern unsigned int	name_find(TASK *, const char *);
 extern int		name_encode(TASK *, char *, const char *, unsigned int, int);
 extern int		name_encode2(TASK *, char **, const char *, unsigned int, int);
@@ -161,13 +164,27 @@ extern int		rr_error(uint32_t, const char *, ...) __printflike(2,3);
 #define formerr(task,rcode,reason,xtra)	_formerr_internal((task),(rcode),(reason),(xtra),__FILE__,__LINE__)
 #define dnserror(task,rcode,reason)			_dnserror_internal((task),(rcode),(reason),__FILE__,__LINE__)
 
+/* event.c */
+extern void		event_init(void);
+extern void		event_reset(void);
+extern int		event_active(void);
+extern const char	*event_backend_name(void);
+extern void		event_task_update(TASK *);
+extern void		event_task_remove(TASK *);
+extern int		event_pending(void);
+extern int		event_wait(int);
+extern TASK		*event_next_ready(int *, int *, int *);
+
 /* ixfr.c */
 extern taskexec_t	ixfr(TASK *, datasection_t, dns_qtype_t, char *, int);
 extern void		ixfr_start(void);
 
 /* listen.c */
 extern char 		**all_interface_addresses(void);
-extern void		create_listeners(void);
+extern void		create_listeners(int);
+extern void		listen_server_start(int);
+extern void		listen_thread_start(int);
+extern void		listen_close_others(void);
 
 /* main.c */
 extern struct timeval	*gettick(void);
@@ -293,10 +310,21 @@ extern taskexec_t	read_tcp_query(TASK *);
 extern taskexec_t	write_tcp_reply(TASK *);
 extern void		tcp_start(void);
 
+/* timer.c */
+extern void		timer_task_update(TASK *);
+extern void		timer_task_set(TASK *, time_t);
+extern void		timer_task_remove(TASK *);
+extern int		timer_next(void);
+extern int		timer_run(void);
+
 /* udp.c */
 extern taskexec_t	read_udp_query(int, int);
 extern taskexec_t	write_udp_reply(TASK *);
 extern void		udp_start(void);
+extern int		udp_batched(TASK *);
+extern int		udp_flush(void);
+extern int		udp_pending(void);
+extern int		udp_batch_size;
 
 /* update.c */
 extern taskexec_t	dns_update(TASK *);
@@ -39,12 +39,12 @@ typedef struct _init_data {
   ARRAY			*zones;		/* Zones to process */
 } INITDATA;
 
-static int notify_tasks_running = 0;
-static int notifyfd = -1;
+static THREADLOCAL int notify_tasks_running = 0;
+static THREADLOCAL int notifyfd = -1;
 
 #if HAVE_IPV6
-static int notifyfd6 = -1;
-static int notify_tasks_running6 = 0;
+static THREADLOCAL int notifyfd6 = -1;
+static THREADLOCAL int notify_tasks_running6 = 0;
 #endif
 
 static void
@@ -235,7 +235,7 @@ notify_write(TASK *t) {
   RELEASE(out);
 
   if(slavecount) {
-    t->timeout = timeout;
+    timer_task_set(t, timeout);
     t->status = NEED_NOTIFY_RETRY;
   }
 
@@ -428,6 +428,8 @@ notify_read(TASK *t) {
       Warn(_("message from %s not a query response or for wrong opcode"), msg);
       if ((newt = task_init(HIGH_PRIORITY_TASK, NEED_ANSWER, t->fd, SOCK_DGRAM, from.sa_family, &from))) {
 	task_new(newt, (unsigned char*)in, rv);
+	event_task_update(newt);
+	timer_task_update(newt);
       }
       RELEASE(msg);
       continue;
@@ -568,8 +570,6 @@ notify_get_server_list(TASK *t, MYDNS_SOA *soa)
     array_append(name_servers, name_server);
   }
 
-  mydns_rr_free(rr);
-
   if (sql_iscolumn(sql, mydns_soa_table_name, "also_notify")) {
     /* Retrieve the ALSO NOTIFY Entries from the SOA */
     querylen = sql_build_query(&query, "SELECT also_notify FROM %s WHERE id=%u;",
@@ -716,8 +716,6 @@ name_servers2ip(TASK *t, ARRAY *name_servers,
       NextA_RR: continue;
       }
 
-      mydns_rr_free(rr);
-
 #if HAVE_IPV6
       rr = find_rr(t, nsoa, DNS_QTYPE_AAAA, label);
 
@@ -761,11 +759,7 @@ name_servers2ip(TASK *t, ARRAY *name_servers,
 
       NextAAAA_RR: continue;
       }
-
-      mydns_rr_free(rr);
-
 #endif
-      mydns_soa_free(nsoa);
 
     }
 
@@ -1013,7 +1007,7 @@ notify_master_tick(TASK *t, int extension) {
     return TASK_COMPLETED;
   }
 
-  t->timeout = current_time + 3600;
+  timer_task_set(t, current_time + 3600);
 
   return TASK_CONTINUE;
 }
@@ -1046,7 +1040,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
       slave->replied = 0;
       slave->retries = 0;
     }
-    t->timeout = current_time;
+    timer_task_set(t, current_time);
   } else {
     /*
      * Build a new task to process this notify operation
@@ -1090,7 +1084,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
     }
 
     if (array_numobjects(slavesipv4) > 0) {
-      static struct sockaddr *notifysource4 = NULL;
+      static THREADLOCAL struct sockaddr *notifysource4 = NULL;
       if (!notifysource4)
 	notifysource4 = notify_get_source(AF_INET, conf_get(&Conf, "notify-source", NULL));
       /* Allocate an fd for this protocol */
@@ -1112,7 +1106,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
 #endif
 	notify_master = IOtask_init(NORMAL_PRIORITY_TASK, NEED_NOTIFY_READ, notifyfd,
 				    SOCK_DGRAM, AF_INET, notifysource4);
-	notify_master->timeout = current_time + 3600;
+	timer_task_set(notify_master, current_time + 3600);
 	task_add_extension(notify_master, NULL, (FreeExtension)notify_master_free, NULL,
 			   (TimeExtension)notify_master_tick);
 	notify_tasks_running = 0;
@@ -1128,7 +1122,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
 #endif
       notify_task = Ticktask_init(NORMAL_PRIORITY_TASK, NEED_NOTIFY_WRITE, notifyfd,
 				  SOCK_DGRAM, AF_INET, NULL);
-      notify_task->timeout = current_time; /* Timeout immediately and therefore run */
+      timer_task_set(notify_task, current_time); /* Timeout immediately and therefore run */
       notify_task->id = notify_task->internal_id;
       task_add_extension(notify_task,
 			 (void*)notify,
@@ -1142,7 +1136,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
   DONEIPV4:
 #if HAVE_IPV6
     if (array_numobjects(slavesipv6)) {
-      static struct sockaddr *notifysource6 = NULL;
+      static THREADLOCAL struct sockaddr *notifysource6 = NULL;
       if (!notifysource6)
 	notifysource6 = notify_get_source(AF_INET6,
 					  conf_get(&Conf, "notify-source6", NULL));
@@ -1165,7 +1159,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
 #endif
 	notify_master = IOtask_init(NORMAL_PRIORITY_TASK, NEED_NOTIFY_READ, notifyfd6,
 				    SOCK_DGRAM, AF_INET6, notifysource6);
-	notify_master->timeout = current_time + 3600;
+	timer_task_set(notify_master, current_time + 3600);
 	task_add_extension(notify_master, NULL, (FreeExtension)notify_master_free, NULL,
 			   (TimeExtension)notify_master_tick);
 	notify_tasks_running6 = 0;
@@ -1181,7 +1175,7 @@ notify_slaves(TASK *t, MYDNS_SOA *soa) {
 #endif
       notify_task = Ticktask_init(NORMAL_PRIORITY_TASK, NEED_NOTIFY_WRITE, notifyfd,
 				  SOCK_DGRAM, AF_INET6, NULL);
-      notify_task->timeout = 0; /* Timeout immediately and therefore run */
+      timer_task_set(notify_task, 0); /* Timeout immediately and therefore run */
       notify_task->id = notify_task->internal_id;
       task_add_extension(notify_task,
 			 (void*)notify,
@@ -1257,7 +1251,7 @@ notify_all_soas(TASK *t, void *data) {
 
   if(initdata->zonecount <= 0) return (TASK_COMPLETED);
 
-  t->timeout = current_time + 1; /* Wait at least 1 seconds before firing the next one */
+  timer_task_set(t, current_time + 1); /* Wait at least 1 seconds before firing the next one */
 
   zone = array_fetch(initdata->zones, initdata->lastzone++);
 
@@ -1270,6 +1264,7 @@ notify_all_soas(TASK *t, void *data) {
       notify_slaves(t, soa);
     }
     mydns_soa_free(soa);
+    zone_cache_release(t);		/* This task lives until every zone is done */
   }
 #if DEBUG_ENABLED && DEBUG_NOTIFY
   else {
@@ -1312,7 +1307,7 @@ notify_start() {
 
   inittask = Ticktask_init(LOW_PRIORITY_TASK, NEED_TASK_RUN, -1, 0, AF_UNSPEC, NULL);
   task_add_extension(inittask, initdata, notify_initfree, notify_all_soas, notify_all_soas);
-  inittask->timeout = current_time + 10; /* Wait 10 seconds before firing first notify set */
+  timer_task_set(inittask, current_time + 10); /* Wait 10 seconds before firing first notify set */
 
 }
 /* vi:set ts=3: */
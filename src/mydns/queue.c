@@ -209,5 +209,8 @@ _requeue(QUEUE **q, TASK *t, const char *file, unsigned int line) {
   __queue_remove(t->TaskQ, t);
   __queue_append(q, t);
 
+  event_task_update(t);
+  timer_task_update(t);
+
 }
 /* vi:set ts=3: */
@@ -25,13 +25,13 @@
 /* Make this nonzero to enable debugging for this source file */
 #define	DEBUG_RECURSIVE	1
 
-static TASK *udp_recursive_master = NULL;
-static TASK *tcp_recursive_master = NULL;
+static THREADLOCAL TASK *udp_recursive_master = NULL;
+static THREADLOCAL TASK *tcp_recursive_master = NULL;
 
-static int recursive_udp_fd = -1;
-static int recursive_tcp_fd = -1;
-static uint32_t tcp_recursion_running = 0;
-static uint32_t udp_recursion_running = 0;
+static THREADLOCAL int recursive_udp_fd = -1;
+static THREADLOCAL int recursive_tcp_fd = -1;
+static THREADLOCAL uint32_t tcp_recursion_running = 0;
+static THREADLOCAL uint32_t udp_recursion_running = 0;
 
 typedef struct _recursive_fwd_write_t {
   char		*query;
@@ -203,6 +203,8 @@ __recursive_fwd_write_timeout(TASK *t, void *data) {
     sockclose(recursive_tcp_fd);
     if (__recursive_start_comms(t, &recursive_tcp_fd, SOCK_STREAM) == TASK_COMPLETED) {
       tcp_recursive_master->status = NEED_RECURSIVE_FWD_CONNECT;
+      event_task_update(tcp_recursive_master);
+      timer_task_update(tcp_recursive_master);
       return TASK_CONTINUE;
     }
     return TASK_FAILED;
@@ -224,14 +226,14 @@ __recursive_fwd_read_timeout(TASK *t, void *data) {
     if (!((t->status == NEED_RECURSIVE_FWD_CONNECT) || (t->status == NEED_RECURSIVE_FWD_CONNECTING))
 	&& (tcp_recursion_running)) {
       /* How often do we allow this to continue */
-      t->timeout = current_time + 120;
+      timer_task_set(t, current_time + 120);
       return TASK_CONTINUE;
     }
     if (recursive_tcp_fd >= 0) sockclose(recursive_tcp_fd);
     recursive_tcp_fd  = -1;
     return TASK_TIMED_OUT;
   }
-  t->timeout = current_time + 120;
+  timer_task_set(t, current_time + 120);
   return TASK_CONTINUE;
 }
 
@@ -353,14 +355,14 @@ __recursive_fwd_write_udp(TASK *t, void *data) {
   if (querylen - rv > 0) {
     querypacket->querywritten += rv;
     t->status = NEED_RECURSIVE_FWD_WRITE;
-    t->timeout = current_time + _recursive_timeout(t, querypacket);
+    timer_task_set(t, current_time + _recursive_timeout(t, querypacket));
 #if DEBUG_ENABLED && DEBUG_RECURSIVE
     DebugX("recursive", 1, _("%s: recursive_fwd_write() UDP - sent partial packet try again later"), desctask(t));
 #endif
     return TASK_CONTINUE;
   } else {
     t->status = NEED_RECURSIVE_FWD_RETRY;
-    t->timeout = current_time + _recursive_timeout(t, querypacket);
+    timer_task_set(t, current_time + _recursive_timeout(t, querypacket));
     querypacket->querywritten = 0;
 #if DEBUG_ENABLED && DEBUG_RECURSIVE
     DebugX("recursive", 1, _("%s: recursive_fwd_write() UDP - sent full packet retry if no reply by timeout"), desctask(t));
@@ -473,11 +475,11 @@ __recursive_fwd_write_tcp(TASK *t, void *data) {
   if (querylen - rv > 0) {
     querypacket->querywritten += rv;
     t->status = NEED_RECURSIVE_FWD_WRITE;
-    t->timeout = current_time + _recursive_timeout(t, querypacket);
+    timer_task_set(t, current_time + _recursive_timeout(t, querypacket));
     return TASK_CONTINUE;
   } else {
     t->status = NEED_RECURSIVE_FWD_RETRY;
-    t->timeout = current_time + _recursive_timeout(t, querypacket);
+    timer_task_set(t, current_time + _recursive_timeout(t, querypacket));
     querypacket->querywritten = 0;
     return TASK_CONTINUE;
   }
@@ -888,8 +890,8 @@ __recursive_fwd_udp(TASK *t) {
   }
 
   task_change_type(t, PERIODIC_TASK);
-  t->timeout = current_time;
-  udp_recursive_master->timeout = current_time + 120;
+  timer_task_set(t, current_time);
+  timer_task_set(udp_recursive_master, current_time + 120);
 
   if (udp_recursive_master->status == NEED_RECURSIVE_FWD_CONNECT
       || udp_recursive_master->status == NEED_RECURSIVE_FWD_CONNECTING) {
@@ -939,8 +941,8 @@ __recursive_fwd_tcp(TASK *t) {
   }
 
   task_change_type(t, PERIODIC_TASK);
-  t->timeout = current_time;
-  tcp_recursive_master->timeout = current_time + 120;
+  timer_task_set(t, current_time);
+  timer_task_set(tcp_recursive_master, current_time + 120);
 
   if (tcp_recursive_master->status == NEED_RECURSIVE_FWD_CONNECT
       || tcp_recursive_master->status == NEED_RECURSIVE_FWD_CONNECTING) {
@@ -1005,7 +1007,7 @@ __recursive_fwd_connect_udp(TASK *t) {
   }
 
   t->status = NEED_RECURSIVE_FWD_READ;
-  t->timeout = current_time + 120;
+  timer_task_set(t, current_time + 120);
 
   assert(t == udp_recursive_master);
 
@@ -1017,7 +1019,7 @@ __recursive_fwd_connect_udp(TASK *t) {
       DebugX("recursive", 1, _("%s: recursive_fwd_connect() restoring task after connect"), desctask(queryt));
 #endif
       queryt->status = NEED_RECURSIVE_FWD_WRITE;
-      queryt->timeout = current_time;
+      timer_task_set(queryt, current_time);
       requeue(&TaskArray[queryt->type][queryt->priority], queryt);
     }
     RELEASE(*connectQ);
@@ -1054,7 +1056,7 @@ __recursive_fwd_connect_tcp(TASK *t) {
       DebugX("recursive", 1, _("%s: connect returns EINPROGRESS"), desctask(t));
 #endif
       /* Set up timeout so that reconnect is attempted */
-      t->timeout = current_time + recursion_connect_timeout;
+      timer_task_set(t, current_time + recursion_connect_timeout);
       t->status = NEED_RECURSIVE_FWD_CONNECTING;
       return TASK_CONTINUE;
     }
@@ -1064,7 +1066,7 @@ __recursive_fwd_connect_tcp(TASK *t) {
   }
 
   t->status = NEED_RECURSIVE_FWD_READ;
-  t->timeout = current_time + 120;
+  timer_task_set(t, current_time + 120);
 
   assert(t == tcp_recursive_master);
 
@@ -1076,7 +1078,7 @@ __recursive_fwd_connect_tcp(TASK *t) {
       DebugX("recursive", 1, _("%s: recursive_fwd_connect() restoring task after connect"), desctask(queryt));
 #endif
       queryt->status = NEED_RECURSIVE_FWD_WRITE;
-      queryt->timeout = current_time;
+      timer_task_set(queryt, current_time);
       requeue(&TaskArray[queryt->type][queryt->priority], queryt);
     }
     RELEASE(*connectQ);
@@ -1117,7 +1119,7 @@ __recursive_fwd_connecting_tcp(TASK *t) {
   }
 
   t->status = NEED_RECURSIVE_FWD_READ;
-  t->timeout = current_time + 120;
+  timer_task_set(t, current_time + 120);
 
   assert(t == tcp_recursive_master);
 
@@ -1129,7 +1131,7 @@ __recursive_fwd_connecting_tcp(TASK *t) {
       DebugX("recursive", 1, _("%s: recursive_fwd_connect() restoring task after connect"), desctask(queryt));
 #endif
       queryt->status = NEED_RECURSIVE_FWD_WRITE;
-      queryt->timeout = current_time;
+      timer_task_set(queryt, current_time);
       requeue(&TaskArray[queryt->type][queryt->priority], queryt);
     }
     RELEASE(*connectQ);
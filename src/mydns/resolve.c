@@ -77,8 +77,6 @@ resolve_soa(TASK *t, datasection_t section, char *fqdn, int level) {
       t->sort_level++;
     }
 
-    mydns_soa_free(soa);
-
     if (section == ANSWER)				/* We are authoritative; Set `aa' flag */
       t->hdr.aa = 1;
     return (TASK_EXECUTED);
@@ -148,12 +146,10 @@ process_rr(TASK *t, datasection_t section, dns_qtype_t qtype, char *fqdn,
 
   t->name_ok = 1;
 
-  /* If the data section calls for a FQDN, and we just get a hostname, append the origin */
-  for (r = rr; r; r = r->next) {
-    if (r->type == DNS_QTYPE_NS || r->type == DNS_QTYPE_CNAME || r->type == DNS_QTYPE_MX) {
-      mydns_rr_data_append_origin(r, soa->origin);
-    }
-  }
+  /*
+   * NS, CNAME and MX data already has the origin appended (by mydns_rr_parse()) - the records
+   * may be shared with the zone cache so they are not changed here
+   */
 
   /* If the RR list returned contains a CNAME record, follow the CNAME. */
   for (r = rr; r; r = r->next)
@@ -213,7 +209,6 @@ process_rr(TASK *t, datasection_t section, dns_qtype_t qtype, char *fqdn,
 
 	    for (a = A; a; a = a->next)
 	      rrlist_add(t, ADDITIONAL, DNS_RRTYPE_RR, (void *)a, MYDNS_RR_DATA_VALUE(r));
-	    mydns_rr_free(A);
 	  }
 	}
 	rv++;
@@ -262,7 +257,6 @@ add_authority_ns(TASK *t, datasection_t section, MYDNS_SOA *soa, char *match_lab
 	      RELEASE(name);
 	    }
 	    t->sort_level++;
-	    mydns_rr_free(rr);
 	    return;
 	  }
 	}
@@ -274,7 +268,6 @@ add_authority_ns(TASK *t, datasection_t section, MYDNS_SOA *soa, char *match_lab
       for (r = rr; r; r = r->next)
 	rrlist_add(t, AUTHORITY, DNS_RRTYPE_RR, (void *)r, soa->origin);
       t->sort_level++;
-      mydns_rr_free(rr);
     }
   }
 }
@@ -304,7 +297,6 @@ resolve_label(TASK *t, datasection_t section, dns_qtype_t qtype,
 
   if (rr) {
     rv = process_rr(t, section, qtype, fqdn, soa, label, rr, level);
-    mydns_rr_free(rr);
     add_authority_ns(t, section, soa, label);
 #if DEBUG_ENABLED && DEBUG_RESOLVE
     DebugX("resolve", 1, _("%s: resolve_label(%s) returning results %s"), desctask(t),
@@ -324,7 +316,6 @@ resolve_label(TASK *t, datasection_t section, dns_qtype_t qtype,
 	ASPRINTF(&newfqdn, "%s.%s", label, soa->origin);
       }
       rv = process_rr(t, AUTHORITY, qtype, newfqdn, soa, label, rr, level);
-      mydns_rr_free(rr);
       RELEASE(newfqdn);
       add_authority_ns(t, section, soa, label);
 #if DEBUG_ENABLED && DEBUG_RESOLVE
@@ -378,7 +369,6 @@ resolve_label(TASK *t, datasection_t section, dns_qtype_t qtype,
 #endif
 	if (rr) {
 	  rv = process_rr(t, section, qtype, fqdn, zsoa, wclabel, rr, level);
-	  mydns_rr_free(rr);
 	  add_authority_ns(t, section, zsoa, wclabel);
 #if DEBUG_ENABLED && DEBUG_RESOLVE
 	  DebugX("resolve", 1, _("%s: resolve_label(%s) returning results %s having matched %s"), desctask(t),
@@ -430,10 +420,6 @@ resolve_label(TASK *t, datasection_t section, dns_qtype_t qtype,
 		   xsoa->origin, zsoa->origin);
 #endif
 	    if (xrr) {
-	      mydns_rr_free(xrr);
-	      if (zsoa != soa) {
-		mydns_soa_free(zsoa);
-	      }
 	      zsoa = xsoa;
 	    } else {
 	      goto NOWILDCARDMATCH;
@@ -568,8 +554,6 @@ resolve(TASK *t, datasection_t section, dns_qtype_t qtype, char *fqdn, int level
     t->sort_level++;
   }
 
-  mydns_soa_free(soa);
-  
   return (rv);
 }	
 /*--- resolve() ---------------------------------------------------------------------------------*/
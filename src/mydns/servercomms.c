@@ -249,7 +249,7 @@ comms_recv(TASK *t, COMMS *comms) {
 
   comms->connectionalive = current_time;
 
-  t->timeout = current_time + KEEPALIVE;
+  timer_task_set(t, current_time + KEEPALIVE);
 
   return TASK_EXECUTED;
 }
@@ -266,7 +266,7 @@ comms_send(TASK *t, COMMS *comms) {
   if (!comms->donesofar) {
     newt = IOtask_init(NORMAL_PRIORITY_TASK, NEED_COMMAND_WRITE, t->fd, t->protocol, t->family, NULL);
     task_add_extension(newt, comms, __comms_free, (RunExtension)comms_send, NULL);
-    newt->timeout = current_time + task_timeout;
+    timer_task_set(newt, current_time + task_timeout);
   } else {
     newt = t;
   }
@@ -331,7 +331,7 @@ comms_start(int fd, FreeExtension comms_freeer, RunExtension comms_runner,
 
   listener = IOtask_init(NORMAL_PRIORITY_TASK, NEED_COMMAND_READ, fd, SOCK_DGRAM, AF_UNIX, NULL);
   task_add_extension(listener, comms, comms_freeer, comms_runner, comms_ticker);
-  listener->timeout = current_time + KEEPALIVE;
+  timer_task_set(listener, current_time + KEEPALIVE);
 
   return listener;
 }
@@ -343,7 +343,7 @@ comms_run(TASK *t, void * data) {
   CommandProcessor	action = NULL;
   char			*args = NULL;
 
-  t->timeout = current_time + KEEPALIVE;
+  timer_task_set(t, current_time + KEEPALIVE);
 
   comms = (COMMS*)data;
 
@@ -391,7 +391,7 @@ scomms_tick(TASK *t, void *data) {
   COMMS		*comms = (COMMS*)data;
   int		lastseen = current_time - comms->connectionalive;
 
-  t->timeout = current_time + KEEPALIVE;
+  timer_task_set(t, current_time + KEEPALIVE);
 
   if (lastseen <= KEEPALIVE) return TASK_CONTINUE;
 
@@ -423,7 +423,7 @@ mcomms_tick(TASK *t, void *data) {
   COMMS		*comms = (COMMS*)data;
   int		lastseen = current_time - comms->connectionalive;
 
-  t->timeout = current_time + KEEPALIVE;
+  timer_task_set(t, current_time + KEEPALIVE);
 
   if (lastseen <= KEEPALIVE) return TASK_CONTINUE;
 
@@ -446,7 +446,7 @@ mcomms_tick(TASK *t, void *data) {
 	server->signalled = SIGTERM;
       }
       kill_server(server, server->signalled);
-      t->timeout = current_time + 5; /* Give the server time to die */
+      timer_task_set(t, current_time + 5); /* Give the server time to die */
       rv = TASK_CONTINUE;
     }
   }
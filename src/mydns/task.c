@@ -25,49 +25,24 @@
 
 
 #define MAXTASKS		(USHRT_MAX + 1)
-#define TASKVECSZ		(MAXTASKS/BITSPERBYTE)
-
-/* Cheat */
-#define TASKVEC_ZERO(TV)	memset((void*)(TV), 0, TASKVECSZ)
-
-static uint32_t		taskvec_masks[] = {
-  0x1,					/* 2^0 */
-  0x2,					/* 2^1 */
-  0x4,					/* 2^2 */
-  0x8,					/* 2^3 */
-  0x10,					/* 2^4 */
-  0x20,					/* 2^5 */
-  0x40,					/* 2^6 */
-  0x80,					/* 2^7 */
-  0x100,				/* 2^8 */
-  0x200,				/* 2^9 */
-  0x400,				/* 2^10 */
-  0x800,				/* 2^11 */
-  0x1000,				/* 2^12 */
-  0x2000,				/* 2^13 */
-  0x4000,				/* 2^14 */
-  0x8000,				/* 2^15 */
-  0x10000,				/* 2^16 */
-  0x20000,				/* 2^17 */
-  0x40000,				/* 2^18 */
-  0x80000,				/* 2^19 */
-  0x100000,				/* 2^20 */
-  0x200000,				/* 2^21 */
-  0x400000,				/* 2^22 */
-  0x800000,				/* 2^23 */
-  0x1000000,				/* 2^24 */
-  0x2000000,				/* 2^25 */
-  0x4000000,				/* 2^26 */
-  0x8000000,				/* 2^27 */
-  0x10000000,				/* 2^28 */
-  0x20000000,				/* 2^29 */
-  0x40000000,				/* 2^30 */
-  0x80000000				/* 2^31 */
-};
-
-static uint32_t		internal_id = 0;
-static uint32_t		*taskvec = NULL;
-static int32_t		active_tasks = 0;
+
+/*
+ * Tasks are recycled through a per-process freelist rather than being calloc'd and freed for
+ * every query.  Only the fields above the name compression dictionary are cleared on reuse,
+ * the dictionary keeps its buffers.  Internal IDs come from a FIFO ring of free IDs so that an
+ * ID is not handed out again until every other free ID has been used.
+ */
+#define TASK_FREELIST_MAX	1024			/* Idle tasks kept for reuse */
+#define TASK_NAMES_KEEP		4096			/* Largest name arena kept on a recycled task */
+
+static THREADLOCAL TASK		*task_freelist = NULL;		/* Idle tasks, linked through `next' */
+static THREADLOCAL int		task_freelist_len = 0;
+
+static THREADLOCAL uint16_t		*task_ids = NULL;		/* Ring of free internal IDs */
+static THREADLOCAL uint32_t		task_ids_head = 0;		/* Next ID to be handed out */
+static THREADLOCAL uint32_t		task_ids_free = 0;		/* Number of free IDs in the ring */
+
+static THREADLOCAL int32_t		active_tasks = 0;
 
 char *
 task_exec_name(taskexec_t rv) {
@@ -86,7 +61,7 @@ task_exec_name(taskexec_t rv) {
 
   default:
     {
-      static char *msg = NULL;
+      static THREADLOCAL char *msg = NULL;
       if (msg) RELEASE(msg);
       ASPRINTF(&msg, _("Task Exec Code %d"), rv);
       return msg;
@@ -105,7 +80,7 @@ task_type_name(int type) {
 
   default:
     {
-      static char *msg = NULL;
+      static THREADLOCAL char *msg = NULL;
       ASPRINTF(&msg, _("Task Type %d"), type);
       return msg;
     }
@@ -123,7 +98,7 @@ task_priority_name(int priority) {
 
   default:
     {
-      static char *msg = NULL;
+      static THREADLOCAL char *msg = NULL;
       ASPRINTF(&msg, _("Task Priority %d"), priority);
       return msg;
     }
@@ -161,7 +136,7 @@ task_status_name(TASK *t) {
 
   default:
     {
-      static char *msg = NULL;
+      static THREADLOCAL char *msg = NULL;
       ASPRINTF(&msg, _("Task Status %X"), t->status);
       return msg;
     }
@@ -408,7 +383,7 @@ clientaddr(TASK *t) {
 **************************************************************************************************/
 char *
 desctask(TASK *t) {
-  static char *desc = NULL;
+  static THREADLOCAL char *desc = NULL;
 
   if (desc) RELEASE(desc);
 
@@ -443,9 +418,6 @@ _task_init(
   TASK				*new = NULL;
   QUEUE				**TaskQ = NULL;
   uint16_t			id = 0;
-  int				taskvec_index;
-  uint32_t			taskvec_mask;
-  int				wrap_round = 0;
 
   if (active_tasks++ >= MAXTASKS) {
     active_tasks -= 1;
@@ -453,29 +425,29 @@ _task_init(
     return NULL;
   }
   
-  if (!taskvec) {
-    taskvec = (uint32_t*)ALLOCATE(TASKVECSZ, uint32_t[]);
-    TASKVEC_ZERO(taskvec);
+  if (!task_ids) {
+    task_ids = ALLOCATE(MAXTASKS * sizeof(uint16_t), uint16_t[]);
+    for (task_ids_free = 0; task_ids_free < MAXTASKS; task_ids_free++)
+      task_ids[task_ids_free] = task_ids_free;
+    task_ids_head = 0;
   }
 
-  while (1) {
-    id = internal_id++;
-    if (internal_id >= MAXTASKS) {
-      if (wrap_round) {
-	Notice(_("internal_id wrapped around twice while trying to find an empty slot"));
-	return NULL;
-      }
-      internal_id = 0;
-      wrap_round = 1;
-    }
-    taskvec_index = id >> 5;
-    taskvec_mask = taskvec_masks[id & 0x1ff];
-    if (!taskvec[taskvec_index]
-	|| (taskvec[taskvec_index] & taskvec_mask) == 0) break;
+  if (!task_ids_free) {
+    active_tasks -= 1;
+    Notice(_("no free internal task IDs"));
+    return NULL;
   }
-  taskvec[taskvec_index] |= taskvec_mask;
+  id = task_ids[task_ids_head];
+  task_ids_head = (task_ids_head + 1) % MAXTASKS;
+  task_ids_free--;
+
+  if ((new = task_freelist)) {
+    task_freelist = new->next;
+    task_freelist_len--;
+    memset(new, 0, offsetof(TASK, Names));
+  } else
+    new = ALLOCATE(sizeof(TASK), TASK);
 
-  new = ALLOCATE(sizeof(TASK), TASK);
 
   new->status = status;
   new->fd = fd;
@@ -502,6 +474,8 @@ _task_init(
   new->runextension = NULL;
   new->timeextension = NULL;
 
+  new->event_fd = -1;
+
   TaskQ = &(TaskArray[type][priority]);
 
   if (enqueue(TaskQ, new) < 0) {
@@ -509,15 +483,20 @@ _task_init(
     return (NULL);
   }
 
+  /* Register the fd with the event backend once, here */
+  event_task_update(new);
+  timer_task_update(new);
+
   return (new);
 }
 /*--- _task_init() -------------------------------------------------------------------------------*/
 
 void
 _task_change_type(TASK *t, tasktype_t type, taskpriority_t priority) {
-  requeue(&TaskArray[type][priority], t);
+  /* Set the new type first so the requeue registers against the right queue */
   t->type = type;
   t->priority = priority;
+  requeue(&TaskArray[type][priority], t);
 }
 
 /**************************************************************************************************
@@ -533,6 +512,9 @@ _task_free(TASK *t, const char *file, int line) {
   DebugX("task", 1, _("%s: Freeing task with fd = %d at %s:%d"), desctask(t), t->fd, file, line);
 #endif
 
+  event_task_remove(t);
+  timer_task_remove(t);
+
   if (t->protocol == SOCK_STREAM && t->fd >= 0) {
     close(t->fd);
   }
@@ -543,28 +525,32 @@ _task_free(TASK *t, const char *file, int line) {
 	
   RELEASE(t->extension);
 	  
-#if DYNAMIC_NAMES
-  {
-    register int n;
-    for (n = 0; n < t->numNames; n++)
-      RELEASE(t->Names[n]);
-    if (t->numNames)
-      RELEASE(t->Names);
-    RELEASE(t->Offsets);
-  }
-#endif
-
   RELEASE(t->query);
   RELEASE(t->qd);
   rrlist_free(&t->an);
   rrlist_free(&t->ns);
   rrlist_free(&t->ar);
+  zone_cache_release(t);
   RELEASE(t->rdata);
   RELEASE(t->reply);
 
-  taskvec[t->internal_id >> 5] &= ~taskvec_masks[t->internal_id & 0x1ff];
-
-  RELEASE(t);
+  /* Return the internal ID to the tail of the ring */
+  task_ids[(task_ids_head + task_ids_free) % MAXTASKS] = t->internal_id;
+  task_ids_free++;
+
+  /* Keep the task for reuse unless there are plenty already */
+  if (task_freelist_len < TASK_FREELIST_MAX) {
+    name_forget(t);
+    if (t->NameArenaSize > TASK_NAMES_KEEP)
+      name_free(t);
+    t->next = task_freelist;
+    task_freelist = t;
+    task_freelist_len++;
+  } else {
+    name_free(t);
+    RELEASE(t->ZoneRefs);
+    RELEASE(t);
+  }
 
   if (--active_tasks < 0) {
     Err(_("Less than zero tasks running ..."));
@@ -712,7 +698,12 @@ task_timedout(TASK *t) {
 	(res == TASK_DID_NOT_EXECUTE)
 	|| (res == TASK_EXECUTED)
 	|| (res == TASK_CONTINUE)
-	) return res;
+	) {
+      /* The extension may have moved the task on to a new state */
+      event_task_update(t);
+      timer_task_update(t);
+      return res;
+    }
   }
 
   t->reason = ERR_TIMEOUT;
@@ -837,6 +828,9 @@ task_process_query(TASK *t, int rfd, int wfd, int efd) {
 	}
       }
       t->status = NEED_WRITE;
+      /* Batched UDP replies go straight on to the send queue, no need to wait for POLLOUT */
+      if (t->protocol == SOCK_DGRAM && udp_batched(t))
+	return write_udp_reply(t);
       return TASK_CONTINUE;
 
     default:
@@ -1212,6 +1206,8 @@ task_process(TASK *t, int rfd, int wfd, int efd) {
   switch(res) {
 
   case TASK_CONTINUE:
+    event_task_update(t);
+    timer_task_update(t);
     break;
 
   case TASK_DID_NOT_EXECUTE:
@@ -1255,7 +1251,7 @@ check_all_tasks(TASK *mytask, void *mydata) {
   int	i = 0, j = 0;
 
   /* Reset my timeout so I do not get run again and I do not process myself ;-( */
-  mytask->timeout = current_time + task_timeout;
+  timer_task_set(mytask, current_time + task_timeout);
 
   for (i = NORMAL_TASK; i <= PERIODIC_TASK; i++) {
     for (j = HIGH_PRIORITY_TASK; j <= LOW_PRIORITY_TASK; j++) {
@@ -1281,7 +1277,7 @@ task_start() {
 
   inittask = Ticktask_init(LOW_PRIORITY_TASK, NEED_TASK_RUN, -1, 0, AF_UNSPEC, NULL);
   task_add_extension(inittask, NULL, NULL, NULL, check_all_tasks);
-  inittask->timeout = current_time + task_timeout;
+  timer_task_set(inittask, current_time + task_timeout);
 
 }
 
@@ -157,6 +157,27 @@ typedef struct _named_rrlist {
 
 typedef struct _named_task *TASKP;
 
+/* TASKNAME: A name remembered for compression */
+typedef struct _named_task_name {
+  unsigned int		name;			/* Offset of the name in the task's NameArena */
+  unsigned int		offset;			/* Offset of the name in the reply */
+  uint32_t		hash;			/* Case folded hash of the name */
+  unsigned int		next;			/* Next name in the hash chain (index + 1) */
+} TASKNAME;
+
+/* TASKNAMEBUCKET: Hash chain of remembered names */
+typedef struct _named_task_name_bucket {
+  uint32_t		gen;			/* Generation the chain belongs to */
+  unsigned int		head;			/* First name in the chain (index + 1) */
+} TASKNAMEBUCKET;
+
+/* ZONEREF: A record handed to the task by zone_cache_find() */
+typedef struct _named_zone_ref {
+  void			*node;			/* Zone cache node holding `data', NULL if the task owns it */
+  void			*data;			/* The MYDNS_SOA or MYDNS_RR list */
+  int			soa;			/* Is `data' a MYDNS_SOA? */
+} ZONEREF;
+
 typedef void (*FreeExtension)(TASKP, void*);
 typedef taskexec_t (*RunExtension)(TASKP, void*);
 typedef taskexec_t (*TimeExtension)(TASKP, void*);
@@ -187,6 +208,20 @@ typedef struct _named_task {
   struct sockaddr_in6	addr6;			/* IPv6 address of client */
 #endif
 
+  /* Event backend registration (event.c) */
+  int			event_state;		/* Idle, waiting for IO or runnable */
+  int			event_fd;		/* FD the task is registered against */
+  int			event_mask;		/* POLLIN/POLLOUT the task is waiting for */
+  int			event_revents;		/* Events delivered but not yet dispatched */
+  int			event_ready;		/* On a ready list (priority + 1) */
+  struct _named_task	*event_prev, *event_next;	/* FD wait list or runnable list */
+  struct _named_task	*ready_prev, *ready_next;	/* Ready for dispatch list */
+
+  /* Timer wheel registration (timer.c) */
+  time_t		timer_when;		/* Deadline the task is filed under */
+  struct _named_task	**timer_list;		/* Wheel slot or list holding the task */
+  struct _named_task	*timer_prev, *timer_next;
+
   /* I/O information for TCP queries */
   size_t		len;			/* Query length */
   char	       		*query;			/* Query data */
@@ -213,17 +248,6 @@ typedef struct _named_task {
 
   int			no_markers;		/* Do not use markers? */
 
-#if DYNAMIC_NAMES
-  char	      		**Names;		/* Names stored in reply */
-  unsigned int   	*Offsets;		/* Offsets for names */
-#else
-#define	MAX_STORED_NAMES	128
-  char			Names[MAX_STORED_NAMES][DNS_MAXNAMELEN + 1];	/* Names stored in reply */
-  unsigned int		Offsets[MAX_STORED_NAMES];			/* Offsets for names */
-#endif
-
-  unsigned int		numNames;		/* Number of names in the list */
-
   uint32_t		zone;			/* Zone ID */
 
   uint8_t		sort_level;		/* Current sort level */
@@ -245,6 +269,25 @@ typedef struct _named_task {
 
   int			update_done;		/* Did we do any dynamic updates? */
   int			info_already_out;	/* Has the info already been output? */
+
+  /*
+   * Everything above is cleared when a task is (re)initialized, the name compression
+   * dictionary (see encode.c) and the list of zone records in use (see cache.c) below
+   * keep their buffers when the task is recycled
+   */
+  TASKNAME		*Names;			/* Names stored in reply */
+  unsigned int		numNames;		/* Number of names in the list */
+  unsigned int		maxNames;		/* Entries allocated in `Names' */
+  char			*NameArena;		/* Text of the names */
+  size_t		NameArenaLen;		/* Octets of `NameArena' in use */
+  size_t		NameArenaSize;		/* Octets allocated for `NameArena' */
+  TASKNAMEBUCKET	*NameBuckets;		/* Hash index of `Names' */
+  unsigned int		numNameBuckets;		/* Size of the index (a power of two) */
+  uint32_t		NameGen;		/* Current generation of the index */
+
+  ZONEREF		*ZoneRefs;		/* Zone records in use, given back when the task is freed */
+  unsigned int		numZoneRefs;		/* Number of records in `ZoneRefs' */
+  unsigned int		maxZoneRefs;		/* Entries allocated in `ZoneRefs' */
 } TASK;
 
 #endif /* !_MYDNS_TASK_H */
@@ -23,11 +23,11 @@
 /* Make this nonzero to enable debugging for this source file */
 #define	DEBUG_TCP	1
 
-extern int	*tcp4_fd;			/* Listening FD's (IPv4) */
-extern int	num_tcp4_fd;			/* Number of listening FD's (IPv4) */
+extern THREADLOCAL int *tcp4_fd;			/* Listening FD's (IPv4) */
+extern THREADLOCAL int num_tcp4_fd;			/* Number of listening FD's (IPv4) */
 #if HAVE_IPV6
-extern int	*tcp6_fd;			/* Listening FD's (IPv6) */
-extern int	num_tcp6_fd;			/* Number of listening FD's (IPv6) */
+extern THREADLOCAL int *tcp6_fd;			/* Listening FD's (IPv6) */
+extern THREADLOCAL int num_tcp6_fd;			/* Number of listening FD's (IPv6) */
 #endif
 
 /**************************************************************************************************
@@ -383,7 +383,7 @@ write_tcp_reply(TASK *t)
 
 static taskexec_t
 tcp_tick(TASK *t, void *data) {
-  t->timeout = current_time + task_timeout;
+  timer_task_set(t, current_time + task_timeout);
 
   return TASK_CONTINUE;
 }
@@ -394,7 +394,7 @@ tcp_read_message(TASK *t, void *data) {
 
   while ((newfd = accept_tcp_query(t->fd, t->family)) >= 0) continue;
 
-  t->timeout = current_time + task_timeout;
+  timer_task_set(t, current_time + task_timeout);
 
   return TASK_CONTINUE;
 }
@@ -0,0 +1,300 @@
+/**************************************************************************************************
+	$Id: timer.c,v 1.0 2009/01/21 10:00:00 howard Exp $
+
+	Copyright (C) 2009  Howard Wilkinson <howard@cohtech.com>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at Your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+**************************************************************************************************/
+
+#include "named.h"
+
+/* Make this nonzero to enable debugging for this source file */
+#define	DEBUG_TIMER	1
+
+/*
+ * Hierarchical timer wheel for task timeouts.
+ *
+ * Level 0 has one slot per second, each higher level has slots covering a whole turn of the
+ * level below.  When level 0 wraps the matching slot of the level above is cascaded down, so
+ * arming, disarming and expiring a task are all constant time and timer_run() only touches
+ * the tasks whose deadline has actually passed.
+ *
+ * Only tasks that can time out (TASKTIMESOUT) and that are on their TaskArray queue are
+ * armed, which is what the old scan of every queue on every loop checked for.
+ * Deadlines beyond the span of the wheel are parked in the furthest slot and re-armed
+ * when they come round.
+ */
+#define TIMER_BITS		6
+#define TIMER_SLOTS		(1 << TIMER_BITS)
+#define TIMER_MASK		(TIMER_SLOTS - 1)
+#define TIMER_LEVELS		4
+#define TIMER_SPAN		((time_t)1 << (TIMER_BITS * TIMER_LEVELS))	/* About 194 days */
+
+#define TIMER_RESYNC		((time_t)TIMER_SLOTS * TIMER_SLOTS)	/* Clock jump that forces a rebuild */
+
+static THREADLOCAL TASK	*timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+static THREADLOCAL TASK	*timer_due = NULL;		/* Deadline passed - fire on the next run */
+static THREADLOCAL TASK	*timer_firing = NULL;		/* Being expired by timer_run() */
+
+static THREADLOCAL time_t	timer_base = 0;			/* Next second of the wheel to be processed */
+static THREADLOCAL int	timer_armed = 0;		/* Tasks on the wheel, due or firing lists */
+
+
+/**************************************************************************************************
+	_TIMER_LINK / _TIMER_UNLINK
+	Add a task to, or remove it from, whichever timer list it is on.
+**************************************************************************************************/
+static void
+_timer_link(TASK **list, TASK *t) {
+  t->timer_prev = NULL;
+  t->timer_next = *list;
+  if (*list) (*list)->timer_prev = t;
+  *list = t;
+  t->timer_list = list;
+  timer_armed++;
+}
+
+static void
+_timer_unlink(TASK *t) {
+  if (!t->timer_list) return;
+
+  if (t->timer_prev) t->timer_prev->timer_next = t->timer_next;
+  else *t->timer_list = t->timer_next;
+  if (t->timer_next) t->timer_next->timer_prev = t->timer_prev;
+
+  t->timer_prev = t->timer_next = NULL;
+  t->timer_list = NULL;
+  timer_armed--;
+}
+/*--- _timer_unlink() ---------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_TIMER_FILE
+	Put a task into the slot for its deadline relative to the current base of the wheel.
+**************************************************************************************************/
+static void
+_timer_file(TASK *t) {
+  time_t	when = t->timer_when;
+  time_t	delta = 0;
+  int		level = 0;
+
+  if (when < timer_base) {
+    _timer_link(&timer_due, t);
+    return;
+  }
+
+  delta = when - timer_base;
+  if (delta >= TIMER_SPAN) {
+    when = timer_base + TIMER_SPAN - 1;
+    delta = TIMER_SPAN - 1;
+  }
+
+  for (level = 0; level < TIMER_LEVELS - 1; level++)
+    if (delta < ((time_t)1 << (TIMER_BITS * (level + 1)))) break;
+
+  _timer_link(&timer_wheel[level][(when >> (TIMER_BITS * level)) & TIMER_MASK], t);
+}
+/*--- _timer_file() -----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_TIMER_REBUILD
+	The clock has jumped a long way (or backwards), refile everything against the new base
+	rather than turning the wheel one second at a time.
+**************************************************************************************************/
+static void
+_timer_rebuild(time_t now) {
+  TASK	*pending = NULL, *t = NULL;
+  int	level = 0, slot = 0;
+
+#if DEBUG_ENABLED && DEBUG_TIMER
+  DebugX("timer", 1, _("clock moved from %ld to %ld - rebuilding timer wheel"),
+	 (long)timer_base, (long)now);
+#endif
+
+  for (level = 0; level < TIMER_LEVELS; level++)
+    for (slot = 0; slot < TIMER_SLOTS; slot++)
+      while ((t = timer_wheel[level][slot])) {
+	_timer_unlink(t);
+	_timer_link(&pending, t);
+      }
+
+  timer_base = now;
+
+  while ((t = pending)) {
+    _timer_unlink(t);
+    _timer_file(t);
+  }
+}
+/*--- _timer_rebuild() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	_TIMER_ADVANCE
+	Turn the wheel up to and including 'now' moving expired slots on to the due list.
+**************************************************************************************************/
+static void
+_timer_advance(time_t now) {
+  TASK	*t = NULL;
+  int	level = 0, slot = 0;
+
+  if (now >= timer_base + TIMER_RESYNC || now < timer_base - 1)
+    _timer_rebuild(now);
+
+  while (timer_base <= now) {
+    slot = timer_base & TIMER_MASK;
+
+    if (!slot) {
+      /* Level 0 has wrapped - cascade the next slot of each level that has wrapped */
+      for (level = 1; level < TIMER_LEVELS; level++) {
+	int cascade = (timer_base >> (TIMER_BITS * level)) & TIMER_MASK;
+	while ((t = timer_wheel[level][cascade])) {
+	  _timer_unlink(t);
+	  _timer_file(t);
+	}
+	if (cascade) break;
+      }
+    }
+
+    while ((t = timer_wheel[0][slot])) {
+      _timer_unlink(t);
+      _timer_link(&timer_due, t);
+    }
+
+    timer_base++;
+  }
+}
+/*--- _timer_advance() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	TIMER_TASK_UPDATE
+	Bring the timer of a task into line with its timeout, status and queue.
+	Called when a task is created, requeued or its status may have changed.
+**************************************************************************************************/
+void
+timer_task_update(TASK *t) {
+  if (!t) return;
+
+  if (!TASKTIMESOUT(t->status)
+      || !t->TaskQ || t->TaskQ != &TaskArray[t->type][t->priority]) {
+    _timer_unlink(t);
+    return;
+  }
+
+  if (t->timer_list && t->timer_list != &timer_firing && t->timer_when == t->timeout) return;
+
+  _timer_unlink(t);
+
+  if (!timer_armed) timer_base = current_time;
+
+  t->timer_when = t->timeout;
+  _timer_file(t);
+}
+/*--- timer_task_update() -----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	TIMER_TASK_SET
+	Set the time a task expires and (re)arm its timer.
+**************************************************************************************************/
+void
+timer_task_set(TASK *t, time_t when) {
+  t->timeout = when;
+  timer_task_update(t);
+}
+/*--- timer_task_set() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	TIMER_TASK_REMOVE
+	Disarm the timer of a task that is being freed.
+**************************************************************************************************/
+void
+timer_task_remove(TASK *t) {
+  if (t) _timer_unlink(t);
+}
+/*--- timer_task_remove() -----------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	TIMER_NEXT
+	Returns the number of seconds until the wheel next needs to be run, or -1 if nothing is
+	armed.  May be early if the next deadline is on a higher level that has to be cascaded.
+**************************************************************************************************/
+int
+timer_next(void) {
+  time_t	when = 0, turn = 0;
+  int		slot = 0;
+
+  if (timer_due || timer_firing) return 0;
+  if (!timer_armed) return -1;
+
+  turn = (timer_base | TIMER_MASK) + 1;
+
+  for (slot = 0; slot < TIMER_SLOTS; slot++) {
+    when = timer_base + slot;
+    if (when >= turn || timer_wheel[0][when & TIMER_MASK]) break;
+  }
+
+  return (when > current_time) ? (int)(when - current_time) : 0;
+}
+/*--- timer_next() ------------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	TIMER_RUN
+	Expire every task whose deadline has passed.  Returns the number of tasks that timed out.
+	Tasks that are re-armed in the past by their time extension fire on the next run.
+**************************************************************************************************/
+int
+timer_run(void) {
+  TASK		*t = NULL;
+  int		fired = 0;
+
+  if (!timer_armed) return 0;
+
+  _timer_advance(current_time);
+
+  while ((t = timer_due)) {
+    _timer_unlink(t);
+    _timer_link(&timer_firing, t);
+  }
+
+  while ((t = timer_firing)) {
+    _timer_unlink(t);
+
+    if (t->timeout > current_time) {
+      /* Deadline was beyond the wheel or moved without being rearmed */
+      timer_task_update(t);
+      continue;
+    }
+    if (!TASKTIMESOUT(t->status)) continue;
+
+#if DEBUG_ENABLED && DEBUG_TIMER
+    DebugX("timer", 1, _("%s: timer expired"), desctask(t));
+#endif
+
+    fired++;
+    task_timedout(t);
+  }
+
+  return fired;
+}
+/*--- timer_run() -------------------------------------------------------------------------------*/
+
+/* vi:set ts=3: */
+/* NEED_PO */
@@ -23,25 +23,269 @@
 /* Make this nonzero to enable debugging for this source file */
 #define	DEBUG_UDP	1
 
-extern int	*udp4_fd;			/* Listening FD's (IPv4) */
-extern int	num_udp4_fd;			/* Number of listening FD's (IPv4) */
+extern THREADLOCAL int *udp4_fd;			/* Listening FD's (IPv4) */
+extern THREADLOCAL int num_udp4_fd;			/* Number of listening FD's (IPv4) */
 #if HAVE_IPV6
-extern int	*udp6_fd;			/* Listening FD's (IPv6) */
-extern int	num_udp6_fd;			/* Number of listening FD's (IPv6) */
+extern THREADLOCAL int *udp6_fd;			/* Listening FD's (IPv6) */
+extern THREADLOCAL int num_udp6_fd;			/* Number of listening FD's (IPv6) */
 #endif
 
+#if HAVE_RECVMMSG && HAVE_SENDMMSG
+#	define UDP_BATCHING 1
+#endif
+
+int		udp_batch_size = 1;		/* Datagrams read or written per system call */
+
+#if UDP_BATCHING
+/*
+ * Batched UDP datapath.
+ *
+ * Each listening socket has a batch.  udp_read_message() drains up to udp_batch_size datagrams
+ * with one recvmmsg() and creates their tasks, which are answered on the same pass of the main
+ * loop.  write_udp_reply() copies each reply into the send side of the batch and udp_flush()
+ * sends everything queued on the socket with one sendmmsg() at the end of the pass.
+ */
+typedef union _udp_addr {
+  struct sockaddr	sa;
+  struct sockaddr_in	sa4;
+#if HAVE_IPV6
+  struct sockaddr_in6	sa6;
+#endif
+} UDPADDR;
+
+typedef struct _udp_batch {
+  int			fd;			/* Listening socket */
+  int			family;			/* AF_INET/AF_INET6 */
+
+  struct mmsghdr	*rmsg;			/* recvmmsg() vector */
+  struct iovec		*riov;
+  UDPADDR		*raddr;
+  char			*rbuf;
+
+  struct mmsghdr	*smsg;			/* sendmmsg() vector */
+  struct iovec		*siov;
+  UDPADDR		*saddr;
+  char			*sbuf;
+  int			queued;			/* Replies queued for sending */
+  int			sent;			/* Replies from the queue already sent */
+} UDPBATCH;
+
+static THREADLOCAL UDPBATCH		*udp_batches = NULL;
+static THREADLOCAL int		num_udp_batches = 0;
+
+static void udp_flush_batch(UDPBATCH *);
+
+static UDPBATCH *
+udp_batch_find(int fd) {
+  int n = 0;
+
+  for (n = 0; n < num_udp_batches; n++)
+    if (udp_batches[n].fd == fd) return &udp_batches[n];
+  return NULL;
+}
+
+static void
+udp_batch_new(int fd, int family) {
+  UDPBATCH	*b = NULL;
+  int		n = 0;
+
+  udp_batches = REALLOCATE(udp_batches, (num_udp_batches + 1) * sizeof(UDPBATCH), UDPBATCH[]);
+  b = &udp_batches[num_udp_batches++];
+  memset(b, 0, sizeof(UDPBATCH));
+
+  b->fd = fd;
+  b->family = family;
+
+  b->rmsg = ALLOCATE(udp_batch_size * sizeof(struct mmsghdr), struct mmsghdr[]);
+  b->riov = ALLOCATE(udp_batch_size * sizeof(struct iovec), struct iovec[]);
+  b->raddr = ALLOCATE(udp_batch_size * sizeof(UDPADDR), UDPADDR[]);
+  b->rbuf = ALLOCATE(udp_batch_size * DNS_MAXPACKETLEN_UDP, char[]);
+
+  b->smsg = ALLOCATE(udp_batch_size * sizeof(struct mmsghdr), struct mmsghdr[]);
+  b->siov = ALLOCATE(udp_batch_size * sizeof(struct iovec), struct iovec[]);
+  b->saddr = ALLOCATE(udp_batch_size * sizeof(UDPADDR), UDPADDR[]);
+  b->sbuf = ALLOCATE(udp_batch_size * DNS_MAXPACKETLEN_UDP, char[]);
+
+  /* The vectors always point at the same buffers, only the lengths change */
+  for (n = 0; n < udp_batch_size; n++) {
+    b->riov[n].iov_base = &b->rbuf[n * DNS_MAXPACKETLEN_UDP];
+    b->rmsg[n].msg_hdr.msg_name = &b->raddr[n];
+    b->rmsg[n].msg_hdr.msg_iov = &b->riov[n];
+    b->rmsg[n].msg_hdr.msg_iovlen = 1;
+
+    b->siov[n].iov_base = &b->sbuf[n * DNS_MAXPACKETLEN_UDP];
+    b->smsg[n].msg_hdr.msg_name = &b->saddr[n];
+    b->smsg[n].msg_hdr.msg_iov = &b->siov[n];
+    b->smsg[n].msg_hdr.msg_iovlen = 1;
+  }
+}
+#endif
+
+
+/**************************************************************************************************
+	UDP_CACHED_REPLY
+	Answer a query straight from the reply cache without creating a task.
+	The header and question are parsed in place; anything other than a plain single-question
+	QUERY for IN or ANY, or a question that is not in the cache, returns 0 and becomes a task
+	as usual.  The cached reply is copied into the socket's send batch (or a scratch buffer when
+	not batching), the ID and flags are patched in and it is sent at once.
+**************************************************************************************************/
+static int
+udp_cached_reply(int fd, int family, struct sockaddr *addr, char *in, int len) {
+  unsigned char		*src = (unsigned char *)in, *end = (unsigned char *)in + len, *qd = NULL;
+  uint16_t		id = 0, qdcount = 0, qtype = 0, qclass = 0;
+  DNS_HEADER		hdr, rhdr;
+  char			*dest = NULL, *p = NULL;
+  size_t		replylen = 0;
+  int			addrlen = 0;
+  char			scratch[DNS_MAXPACKETLEN_UDP];
+#if UDP_BATCHING
+  UDPBATCH		*b = NULL;
+  int			n = 0;
+#endif
+
+  /* Queries have to be logged or counted one by one - let the task do it */
+  if (!ReplyCache || err_verbose || answer_then_quit)
+    return (0);
+
+  if (len < DNS_HEADERSIZE || len > DNS_MAXPACKETLEN_UDP)
+    return (0);
+
+  DNS_GET16(id, src);
+  memcpy(&hdr, src, SIZE16); src += SIZE16;
+  DNS_GET16(qdcount, src);
+  src += SIZE16 * 3;						/* ancount, nscount, arcount */
+
+  if (hdr.qr || hdr.tc || hdr.opcode != DNS_OPCODE_QUERY || qdcount != 1)
+    return (0);
+
+  /* Walk the labels of the name, compression pointers are left to the task */
+  qd = src;
+  while (src < end && *src) {
+    if (*src > DNS_MAXLABELLEN)
+      return (0);
+    src += *src + 1;
+  }
+  if (src + 1 + SIZE16 + SIZE16 > end)
+    return (0);
+  src++;
+
+  DNS_GET16(qtype, src);
+  DNS_GET16(qclass, src);
+
+  if (qclass != DNS_CLASS_IN && qclass != DNS_CLASS_ANY)
+    return (0);
+  if (qtype == DNS_QTYPE_AXFR || qtype == DNS_QTYPE_IXFR)
+    return (0);
+
+  if (family == AF_INET) {
+    addrlen = sizeof(struct sockaddr_in);
+#if HAVE_IPV6
+  } else if (family == AF_INET6) {
+    addrlen = sizeof(struct sockaddr_in6);
+#endif
+  }
+
+  dest = scratch;
+#if UDP_BATCHING
+  if ((b = udp_batch_find(fd))) {
+    if (b->queued == udp_batch_size)
+      udp_flush_batch(b);
+    if (b->queued == udp_batch_size)
+      return (0);						/* Socket is full - let a task wait for it */
+    n = b->queued;
+    dest = b->siov[n].iov_base;
+  }
+#endif
+
+  /* The reply is copied out under the cache lock, it may be shared with other servers */
+  replylen = reply_cache_peek(qtype, SOCK_DGRAM, qd, src - qd, dest, DNS_MAXPACKETLEN_UDP, &rhdr);
+  if (replylen < DNS_HEADERSIZE)
+    return (0);
+
+  p = dest;
+  DNS_PUT16(p, id);						/* Query ID */
+  DNS_PUT(p, &rhdr, SIZE16);					/* Header */
+
+#if UDP_BATCHING
+  if (b) {
+    b->siov[n].iov_len = replylen;
+    memcpy(&b->saddr[n], addr, addrlen);
+    b->smsg[n].msg_hdr.msg_namelen = addrlen;
+    b->queued++;
+  } else
+#endif
+  if (sendto(fd, dest, replylen, 0, addr, addrlen) < 0) {
+    if (errno == EINTR
+#ifdef EAGAIN
+	|| errno == EAGAIN
+#else
+#ifdef EWOULDBLOCK
+	|| errno == EWOULDBLOCK
+#endif
+#endif
+	)
+      return (0);						/* Let a task retry the send */
+    if (errno != EPERM && errno != EINVAL)
+      Warn("%s", _("sendto (UDP)"));
+  }
+
+  Status.udp_requests++;
+  if (rhdr.rcode < MAX_RESULTS)
+    Status.results[rhdr.rcode]++;
+
+#if DEBUG_ENABLED && DEBUG_UDP
+  DebugX("udp", 1, _("fd %d: %u UDP octets from reply cache (id %u)"), fd, (unsigned int)replylen, id);
+#endif
+  return (1);
+}
+/*--- udp_cached_reply() ------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	UDP_QUERY_TASK
+	Create the task for a query that has been read.
+**************************************************************************************************/
+static taskexec_t
+udp_query_task(int fd, int family, struct sockaddr *addr, char *in, int len) {
+  TASK			*t = NULL;
+  taskexec_t		rv = TASK_FAILED;
+
+  if (len == 0) {
+    return (TASK_FAILED);
+  }
+  if (udp_cached_reply(fd, family, addr, in, len))
+    return (TASK_COMPLETED);
+
+  if (!(t = IOtask_init(HIGH_PRIORITY_TASK, NEED_ANSWER, fd, SOCK_DGRAM, family, addr)))
+    return (TASK_FAILED);
+
+#if DEBUG_ENABLED && DEBUG_UDP
+  DebugX("udp", 1, "%s: %d %s", clientaddr(t), len, _("UDP octets in"));
+#endif
+  rv = task_new(t, (unsigned char*)in, len);
+  if (rv < TASK_FAILED) {
+    dequeue(t);
+    rv = TASK_FAILED;
+  } else {
+    event_task_update(t);
+    timer_task_update(t);
+  }
+  return rv;
+}
+/*--- udp_query_task() --------------------------------------------------------------------------*/
+
+
 /**************************************************************************************************
 	READ_UDP_QUERY
 	Returns 0 on success (a task was added), -1 on failure.
 **************************************************************************************************/
 taskexec_t
 read_udp_query(int fd, int family) {
-  struct sockaddr	addr;
+  struct sockaddr_storage addr;
   char			in[DNS_MAXPACKETLEN_UDP];
   socklen_t 		addrlen = 0;
   int			len = 0;
-  TASK			*t = NULL;
-  taskexec_t		rv = TASK_FAILED;
 
   memset(&addr, 0, sizeof(addr));
   memset(&in, 0, sizeof(in));
@@ -55,7 +299,7 @@ read_udp_query(int fd, int family) {
 #endif
   }
 
-  if ((len = recvfrom(fd, &in, sizeof(in), 0, &addr, &addrlen)) < 0) {
+  if ((len = recvfrom(fd, &in, sizeof(in), 0, (struct sockaddr*)&addr, &addrlen)) < 0) {
     if (
 	(errno == EINTR)
 #ifdef EAGAIN
@@ -70,23 +314,182 @@ read_udp_query(int fd, int family) {
     }
     return Warn("%s", _("recvfrom (UDP)"));
   }
-  if (len == 0) {
-    return (TASK_FAILED);
+  return udp_query_task(fd, family, (struct sockaddr*)&addr, in, len);
+}
+/*--- read_udp_query() --------------------------------------------------------------------------*/
+
+
+#if UDP_BATCHING
+/**************************************************************************************************
+	READ_UDP_BATCH
+	Read up to udp_batch_size queries with one recvmmsg() and create their tasks.
+	Returns TASK_CONTINUE once the socket has been drained.
+**************************************************************************************************/
+static taskexec_t
+read_udp_batch(UDPBATCH *b) {
+  int			n = 0, i = 0;
+
+  for (i = 0; i < udp_batch_size; i++) {
+    b->riov[i].iov_len = DNS_MAXPACKETLEN_UDP;
+    b->rmsg[i].msg_hdr.msg_namelen = sizeof(UDPADDR);
+    b->rmsg[i].msg_hdr.msg_control = NULL;
+    b->rmsg[i].msg_hdr.msg_controllen = 0;
+    b->rmsg[i].msg_hdr.msg_flags = 0;
   }
-  if (!(t = IOtask_init(HIGH_PRIORITY_TASK, NEED_ANSWER, fd, SOCK_DGRAM, family, &addr)))
-    return (TASK_FAILED);
+
+  if ((n = recvmmsg(b->fd, b->rmsg, udp_batch_size, MSG_DONTWAIT, NULL)) < 0) {
+    if (
+	(errno == EINTR)
+#ifdef EAGAIN
+	|| (errno == EAGAIN)
+#else
+#ifdef EWOULDBLOCK
+	|| (errno == EWOULDBLOCK)
+#endif
+#endif
+	) {
+      return (TASK_CONTINUE);
+    }
+    return Warn("%s", _("recvmmsg (UDP)"));
+  }
+
+  Status.udp_recv_calls++;
+  Status.udp_recv_msgs += n;
 
 #if DEBUG_ENABLED && DEBUG_UDP
-  DebugX("udp", 1, "%s: %d %s", clientaddr(t), len, _("UDP octets in"));
+  DebugX("udp", 1, _("fd %d: recvmmsg returned %d of %d datagrams"), b->fd, n, udp_batch_size);
 #endif
-  rv = task_new(t, (unsigned char*)in, len);
-  if (rv < TASK_FAILED) {
-    dequeue(t);
-    rv = TASK_FAILED;
+
+  for (i = 0; i < n; i++)
+    udp_query_task(b->fd, b->family, &b->raddr[i].sa, b->riov[i].iov_base, b->rmsg[i].msg_len);
+
+  return (n < udp_batch_size) ? TASK_CONTINUE : TASK_EXECUTED;
+}
+/*--- read_udp_batch() --------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	UDP_FLUSH_BATCH
+	Send the replies queued on a batch.  If the socket buffer fills up the rest stay queued
+	and are sent by the next flush.
+**************************************************************************************************/
+static void
+udp_flush_batch(UDPBATCH *b) {
+  int			n = 0;
+
+  while (b->sent < b->queued) {
+    if ((n = sendmmsg(b->fd, &b->smsg[b->sent], b->queued - b->sent, 0)) < 0) {
+      if (errno == EINTR) continue;
+      if (
+#ifdef EAGAIN
+	  (errno == EAGAIN)
+#else
+#ifdef EWOULDBLOCK
+	  (errno == EWOULDBLOCK)
+#endif
+#endif
+	  ) return;
+      /* The error belongs to the first unsent reply - drop it and carry on with the rest */
+      if (errno != EPERM && errno != EINVAL)
+	Warn("%s", _("sendmmsg (UDP)"));
+      b->sent++;
+      continue;
+    }
+    Status.udp_send_calls++;
+    Status.udp_send_msgs += n;
+    b->sent += n;
   }
-  return rv;
+
+#if DEBUG_ENABLED && DEBUG_UDP
+  DebugX("udp", 1, _("fd %d: sendmmsg sent %d replies"), b->fd, b->sent);
+#endif
+
+  b->queued = b->sent = 0;
 }
-/*--- read_udp_query() --------------------------------------------------------------------------*/
+/*--- udp_flush_batch() -------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	QUEUE_UDP_REPLY
+	Copy the reply for a task into the send side of its socket's batch.
+**************************************************************************************************/
+static taskexec_t
+queue_udp_reply(UDPBATCH *b, TASK *t, struct sockaddr *addr, int addrlen) {
+  int			n = 0;
+
+  if (b->queued == udp_batch_size)
+    udp_flush_batch(b);
+  if (b->queued == udp_batch_size)
+    return (TASK_CONTINUE); /* Socket is full - try again */
+
+  n = b->queued++;
+
+  memcpy(b->siov[n].iov_base, t->reply, t->replylen);
+  b->siov[n].iov_len = t->replylen;
+  memcpy(&b->saddr[n], addr, addrlen);
+  b->smsg[n].msg_hdr.msg_namelen = addrlen;
+
+#if DEBUG_ENABLED && DEBUG_UDP
+  DebugX("udp", 1, _("%s: QUEUE %u UDP octets (id %u)"), desctask(t), (unsigned int)t->replylen, t->id);
+#endif
+  return (TASK_COMPLETED);
+}
+/*--- queue_udp_reply() -------------------------------------------------------------------------*/
+#endif
+
+
+/**************************************************************************************************
+	UDP_BATCHED
+	Will the reply for this task be batched?  If so it need not wait for the socket to be
+	writable.
+**************************************************************************************************/
+int
+udp_batched(TASK *t) {
+#if UDP_BATCHING
+  return (udp_batch_find(t->fd) && t->replylen <= DNS_MAXPACKETLEN_UDP);
+#else
+  return 0;
+#endif
+}
+/*--- udp_batched() -----------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	UDP_FLUSH
+	Send all of the batched replies.  Called at the end of each pass of the main loop.
+	Returns the number of replies still waiting for socket space.
+**************************************************************************************************/
+int
+udp_flush(void) {
+  int			pending = 0;
+#if UDP_BATCHING
+  int			n = 0;
+
+  for (n = 0; n < num_udp_batches; n++) {
+    if (udp_batches[n].queued) udp_flush_batch(&udp_batches[n]);
+    pending += udp_batches[n].queued - udp_batches[n].sent;
+  }
+#endif
+  return pending;
+}
+/*--- udp_flush() -------------------------------------------------------------------------------*/
+
+
+/**************************************************************************************************
+	UDP_PENDING
+	Are there replies waiting for socket space?
+**************************************************************************************************/
+int
+udp_pending(void) {
+#if UDP_BATCHING
+  int			n = 0;
+
+  for (n = 0; n < num_udp_batches; n++)
+    if (udp_batches[n].queued) return 1;
+#endif
+  return 0;
+}
+/*--- udp_pending() -----------------------------------------------------------------------------*/
 
 
 /**************************************************************************************************
@@ -97,6 +500,9 @@ write_udp_reply(TASK *t) {
   int			rv = 0;
   struct sockaddr	*addr = NULL;
   int			addrlen = 0;
+#if UDP_BATCHING
+  UDPBATCH		*b = NULL;
+#endif
 
   if (t->family == AF_INET) {
     addr = (struct sockaddr*)&t->addr4;
@@ -107,6 +513,11 @@ write_udp_reply(TASK *t) {
     addrlen = sizeof(struct sockaddr_in6);
 #endif
   }
+
+#if UDP_BATCHING
+  if ((b = udp_batch_find(t->fd)) && t->replylen <= DNS_MAXPACKETLEN_UDP)
+    return queue_udp_reply(b, t, addr, addrlen);
+#endif
 	
   rv = sendto(t->fd, t->reply, t->replylen, 0, addr, addrlen);
 
@@ -157,7 +568,7 @@ write_udp_reply(TASK *t) {
 static taskexec_t
 udp_tick(TASK *t, void *data) {
 
-  t->timeout = current_time + task_timeout;
+  timer_task_set(t, current_time + task_timeout);
 
   return TASK_CONTINUE;
 }
@@ -165,10 +576,20 @@ udp_tick(TASK *t, void *data) {
 static taskexec_t
 udp_read_message(TASK *t, void *data) {
   taskexec_t	res;
+#if UDP_BATCHING
+  UDPBATCH	*b = NULL;
+
+  if ((b = udp_batch_find(t->fd))) {
+    /* One batch per pass - the queries are answered and flushed before the next is read */
+    read_udp_batch(b);
+    timer_task_set(t, current_time + task_timeout);
+    return TASK_CONTINUE;
+  }
+#endif
 
   while((res = read_udp_query(t->fd, t->family)) != TASK_CONTINUE) continue;
 
-  t->timeout = current_time + task_timeout;
+  timer_task_set(t, current_time + task_timeout);
 
   return TASK_CONTINUE;
 }
@@ -177,6 +598,21 @@ void
 udp_start() {
   int		n = 0;
 
+  udp_batch_size = atoi(conf_get(&Conf, "udp-batch", NULL));
+  if (udp_batch_size < 1) udp_batch_size = 1;
+  if (udp_batch_size > 1024) udp_batch_size = 1024;
+
+#if UDP_BATCHING
+  if (udp_batch_size > 1) {
+    for (n = 0; n < num_udp4_fd; n++)
+      udp_batch_new(udp4_fd[n], AF_INET);
+#if HAVE_IPV6
+    for (n = 0; n < num_udp6_fd; n++)
+      udp_batch_new(udp6_fd[n], AF_INET6);
+#endif
+  }
+#endif
+
   for (n = 0; n < num_udp4_fd; n++) {
     TASK *udptask = IOtask_init(HIGH_PRIORITY_TASK, NEED_TASK_READ,
 				udp4_fd[n], SOCK_DGRAM, AF_INET, NULL);